@@ -99,6 +99,40 @@ int main()
 				// Add a new light shape on right click
 				ls.createLightShape(blocker);
 			}
+			// Print the counters of the last render when F1 is pressed
+			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F1)
+			{
+				const auto& stats = ls.getRenderStats();
+				std::cout << "Draw calls : " << stats._drawCalls << ", culled shapes : " << stats._culledShapes << ", occluded shapes : " << stats._occludedShapes << ", offscreen shapes : " << stats._offscreenShapes << ", cached lights : " << stats._cachedLights << ", cached shadow tiles : " << stats._cachedShadowTiles << ", batched lights : " << stats._batchedLights << std::endl;
+				std::cout << "Hard shadow masks : " << stats._batchedMasks << " in " << stats._maskBatches << " draw calls, draw calls without mask batching : " << stats._drawCalls - stats._maskBatches + stats._batchedMasks << std::endl;
+			}
+			// Add the benchmark scene when F3 is pressed : a grid of 200 boxes around the mouse light, then press F1 to read the counters
+			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F3)
+			{
+				sf::Vector2f center = mlight->getPosition();
+				for (int y = 0; y < 10; y++)
+				{
+					for (int x = 0; x < 20; x++)
+					{
+						if (x >= 9 && x <= 10 && y >= 4 && y <= 5)
+						{
+							continue;
+						}
+						sf::RectangleShape box;
+						box.setSize({ 12.f, 12.f });
+						box.setPosition(center + sf::Vector2f(x * 40.f - 400.f, y * 40.f - 200.f));
+						box.setFillColor(sf::Color::Red);
+						shapes.push_back(box);
+						ls.createLightShape(box);
+					}
+				}
+			}
+			// Cycle the light buffer downscale (1, 2, 4) when F2 is pressed, to compare the counters and the frame time
+			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F2)
+			{
+				ls.setLightBufferDownscale(ls.getLightBufferDownscale() >= 4 ? 1 : ls.getLightBufferDownscale() * 2);
+				std::cout << "Light buffer downscale : " << ls.getLightBufferDownscale() << std::endl;
+			}
 			// Add a point light when left click
 			if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
 			{
@@ -7,6 +7,7 @@
 #include "LightShape.hpp"
 #include "LightSystem.hpp"
 #include "Sprite.hpp"
+#include "TileMap.hpp"
 #include "Utils.hpp"
 
 #endif // LTBL2_HPP
\ No newline at end of file
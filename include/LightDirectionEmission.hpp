@@ -1,5 +1,7 @@
 #pragma once
 
+#include <map>
+
 #include "Utils.hpp"
 #include "LightShape.hpp"
 
@@ -37,8 +39,10 @@ class LightDirectionEmission : public priv::BaseLight
 		/// \param unshadowShader The unshadow shader
 		/// \param shapes The shapes affected by the light
 		/// \param shadowExtension The shadow extension
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
+		/// \param stats The counters of the render, increased by the draw calls
 		//////////////////////////////////////////////////////////////////////////
-		void render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, const std::vector<priv::QuadtreeOccupant*>& shapes, float shadowExtension);
+		void render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, const std::vector<priv::QuadtreeOccupant*>& shapes, float shadowExtension, unsigned int convexSilhouetteThreshold, RenderStats& stats);
 
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Set the cast direction of the light
@@ -90,6 +94,54 @@ class LightDirectionEmission : public priv::BaseLight
 		//////////////////////////////////////////////////////////////////////////
 		float getSourceDistance() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the size of the world space tiles the shadows are cached in
+		/// Tiles are only rendered again when their shapes change, or when the cast angle moved by more than the angle epsilon
+		/// \param size The new size of the tiles, 0 to render the shadows for the view every frame
+		//////////////////////////////////////////////////////////////////////////
+		void setShadowTileSize(float size);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the size of the world space tiles the shadows are cached in
+		/// \return The current size of the tiles, 0 if the shadows are not cached
+		//////////////////////////////////////////////////////////////////////////
+		float getShadowTileSize() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the cast angle change from which the shadow tiles are rendered again
+		/// \param epsilon The new angle epsilon, in degrees
+		//////////////////////////////////////////////////////////////////////////
+		void setShadowTileAngleEpsilon(float epsilon);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the cast angle change from which the shadow tiles are rendered again
+		/// \return The current angle epsilon, in degrees
+		//////////////////////////////////////////////////////////////////////////
+		float getShadowTileAngleEpsilon() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether a shadow tile has to be rendered again, and remember the current state
+		/// Used by the light system when the shadows are cached
+		/// \param tile The grid coordinates of the tile
+		/// \param shapes The shapes whose shadows can reach the tile
+		/// \param pixels The size of the tile texture
+		/// \return True if the tile is new, or if the light or the shapes changed since it was rendered
+		//////////////////////////////////////////////////////////////////////////
+		bool updateShadowTile(const sf::Vector2i& tile, const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int pixels);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the texture of a shadow tile, after updateShadowTile
+		/// \param tile The grid coordinates of the tile
+		/// \return The render texture of the tile
+		//////////////////////////////////////////////////////////////////////////
+		sf::RenderTexture& getShadowTileTexture(const sf::Vector2i& tile);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Release the shadow tiles which were not updated for a while
+		/// Used by the light system once all the visible tiles are updated
+		//////////////////////////////////////////////////////////////////////////
+		void releaseShadowTiles();
+
 	private:
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Get the penumbras from a direction
@@ -98,9 +150,78 @@ class LightDirectionEmission : public priv::BaseLight
 		/// \param innerBoundaryVectors The inner boundary vectors
 		/// \param outerBoundaryIndices The outer boundary indices
 		/// \param outerBoundaryVectors The outer boundary vectors
+		/// \param umbraPenumbras The indices of the last penumbra of each side, whose source and dark edge bound the umbra
 		/// \param shape The shape
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
 		//////////////////////////////////////////////////////////////////////////
-		void getPenumbrasDirection(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape);
+		void getPenumbrasDirection(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, std::vector<unsigned int>& umbraPenumbras, const LightShape& shape, unsigned int convexSilhouetteThreshold);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether a side of a shape is facing the light
+		/// \param facingFrontBothEdges Is the side facing both edges of the source ?
+		/// \param facingFrontOneEdge Is the side facing at least one edge of the source ?
+		/// \param pointToNextPoint The side, from its first point to the next one
+		/// \param leftEdgeRay The ray from the left edge of the source
+		/// \param rightEdgeRay The ray from the right edge of the source
+		//////////////////////////////////////////////////////////////////////////
+		void getFacing(bool& facingFrontBothEdges, bool& facingFrontOneEdge, const sf::Vector2f& pointToNextPoint, const sf::Vector2f& leftEdgeRay, const sf::Vector2f& rightEdgeRay) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the boundaries of a convex shape, searching around its extreme points
+		/// \param innerBoundaryIndices The inner boundary indices
+		/// \param bothEdgesBoundaryWindings The windings of the inner boundaries
+		/// \param outerBoundaryIndices The outer boundary indices
+		/// \param leftEdgeRay The ray from the left edge of the source
+		/// \param rightEdgeRay The ray from the right edge of the source
+		/// \param shape The shape
+		/// \return True if the boundaries were found, false if the shape has to be walked entirely
+		//////////////////////////////////////////////////////////////////////////
+		bool getConvexBoundaries(std::vector<int>& innerBoundaryIndices, std::vector<bool>& bothEdgesBoundaryWindings, std::vector<int>& outerBoundaryIndices, const sf::Vector2f& leftEdgeRay, const sf::Vector2f& rightEdgeRay, const LightShape& shape) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Silhouette of a shape for the current cast direction
+		//////////////////////////////////////////////////////////////////////////
+		struct Silhouette
+		{
+			std::vector<priv::Penumbra> _penumbras; ///< The penumbras
+			std::vector<int> _innerBoundaryIndices; ///< The inner boundary indices
+			std::vector<sf::Vector2f> _innerBoundaryVectors; ///< The inner boundary vectors
+			std::vector<int> _outerBoundaryIndices; ///< The outer boundary indices
+			std::vector<sf::Vector2f> _outerBoundaryVectors; ///< The outer boundary vectors
+			std::vector<unsigned int> _umbraPenumbras; ///< The last penumbra of each side, bounding the umbra
+			sf::Vector2f _castDirection; ///< The cast direction used to compute it
+			float _sourceRadius; ///< The source radius used to compute it
+			float _sourceDistance; ///< The source distance used to compute it
+			std::size_t _shapeVersion; ///< The version of the shape used to compute it
+			unsigned int _lastUse; ///< The last render which used it
+		};
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Shadows cached for a world space tile
+		//////////////////////////////////////////////////////////////////////////
+		struct ShadowTile
+		{
+			std::unique_ptr<sf::RenderTexture> _texture; ///< The shadowed light of the tile
+			float _castAngle; ///< The cast angle used to render it
+			float _sourceRadius; ///< The source radius used to render it
+			float _sourceDistance; ///< The source distance used to render it
+			sf::Color _color; ///< The color used to render it
+			std::size_t _signature; ///< The signature of the shapes used to render it
+			unsigned int _lastUse; ///< The last tile pass which used it
+		};
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the silhouette of a shape, computing it only if the cached one is outdated
+		/// \param shape The shape
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
+		/// \return The silhouette
+		//////////////////////////////////////////////////////////////////////////
+		const Silhouette& getSilhouette(const LightShape& shape, unsigned int convexSilhouetteThreshold);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Release the silhouettes not used for a few renders
+		//////////////////////////////////////////////////////////////////////////
+		void releaseSilhouettes();
 
 	private:
 		sf::RectangleShape mShape; ///< The shape to apply light color
@@ -110,6 +231,17 @@ class LightDirectionEmission : public priv::BaseLight
 
 		float mSourceRadius; ///< The source radius
 		float mSourceDistance; ///< The source distance
+
+		std::unordered_map<const LightShape*, Silhouette> mSilhouettes; ///< The cached silhouettes, by shape
+		unsigned int mRenderCount; ///< The number of renders, used to release the silhouettes of shapes out of range or removed
+
+		priv::AntumbraPacker mAntumbraPacker; ///< The antumbras of the shapes, packed in the antumbra texture
+		sf::VertexArray mMaskVertices; ///< The umbras of the shapes, drawn at once
+
+		float mShadowTileSize; ///< The size of the shadow tiles, 0 if the shadows are not cached
+		float mShadowTileAngleEpsilon; ///< The cast angle change from which the shadow tiles are rendered again
+		std::map<std::pair<int, int>, ShadowTile> mShadowTiles; ///< The cached shadow tiles, by grid coordinates
+		unsigned int mShadowTilePass; ///< The number of tile passes, used to release the tiles out of view for a while
 };
 
 } // namespace ltbl
\ No newline at end of file
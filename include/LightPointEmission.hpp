@@ -168,8 +168,14 @@ class LightPointEmission : public priv::QuadtreeOccupant, public priv::BaseLight
 		/// \param unshadowShader The unshadow shader
 		/// \param lightOverShapeShader The light over shape shader
 		/// \param shapes The shapes affected by the light
+		/// \param normalsEnabled Do the light use the normals ?
+		/// \param normalsShader The normals shader
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
+		/// \param pass The render pass, the shadows are computed only once for all the views of a pass
+		/// \param lod The level of detail of the shadows
+		/// \param stats The counters of the render, increased by the culled shapes and the draw calls
 		//////////////////////////////////////////////////////////////////////////
-		void render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, sf::Shader& lightOverShapeShader, const std::vector<priv::QuadtreeOccupant*>& shapes, bool normalsEnabled, sf::Shader& normalsShader);
+		void render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, sf::Shader& lightOverShapeShader, const std::vector<priv::QuadtreeOccupant*>& shapes, bool normalsEnabled, sf::Shader& normalsShader, unsigned int convexSilhouetteThreshold, unsigned int pass, priv::ShadowLod lod, RenderStats& stats);
 
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Set the local cast center of the light
@@ -207,19 +213,160 @@ class LightPointEmission : public priv::QuadtreeOccupant, public priv::BaseLight
 		//////////////////////////////////////////////////////////////////////////
 		float getShadowOverExtendMultiplier() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the effective radius of the light, around the cast center
+		/// Shapes out of the radius are culled, use it when the texture is black beyond a circle
+		/// \param radius The new radius, 0 to use the whole AABB box of the light
+		//////////////////////////////////////////////////////////////////////////
+		void setRadius(float radius);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the effective radius of the light
+		/// \return The current radius, 0 if the whole AABB box of the light is used
+		//////////////////////////////////////////////////////////////////////////
+		float getRadius() const;
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Get the AABB box of the light
 		/// \return The AABB box
 		//////////////////////////////////////////////////////////////////////////
 		sf::FloatRect getAABB() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set whether the light casts shadows
+		/// Lights without shadows skip the light render texture, they are batched by texture and added to the composition at once
+		/// \param castShadows True to cast shadows, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		void setCastShadows(bool castShadows);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Does the light cast shadows ?
+		/// \return True if the light casts shadows, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool castsShadows() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Append the quad of the light texture, as two triangles in world coordinates
+		/// Used by the light system to batch the lights without shadows
+		/// \param vertices The triangles
+		//////////////////////////////////////////////////////////////////////////
+		void appendEmission(sf::VertexArray& vertices) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set whether the light is static
+		/// The shadowed light of a static light is cached, and only rendered again when the light or the shapes in its AABB box change
+		/// \param staticLight True to cache the light, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		void setStatic(bool staticLight);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Is the light static ?
+		/// \return True if the light is cached, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isStatic() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether the light itself did not change since its cache was rendered
+		/// Used by the light system for cached lights
+		/// \return True if the cache exists and the light did not move or change, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isCacheValid() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether neither the light nor its shapes changed since its cache was rendered
+		/// Used by the light system for cached lights
+		/// \param shapes The shapes in the AABB box of the light
+		/// \return True if the cache can be composited as is, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isCacheCurrent(const std::vector<priv::QuadtreeOccupant*>& shapes) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Remember the state the cache was just rendered from
+		/// Used by the light system for cached lights
+		/// \param shapes The shapes in the AABB box of the light
+		/// \param frame The frame the cache was rendered in
+		//////////////////////////////////////////////////////////////////////////
+		void validateCache(const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int frame);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the frame the cache was last rendered in
+		/// \return The frame of the last render of the cache
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getCacheRenderFrame() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Mark the cache as composited in a frame
+		/// Used by the light system for cached lights
+		/// \param frame The current frame
+		/// \return The previous frame the cache was composited in
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int useCache(unsigned int frame);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the cache render texture, created with the given size
+		/// Used by the light system for static lights
+		/// \param size The size of the cache
+		/// \return The cache render texture
+		//////////////////////////////////////////////////////////////////////////
+		sf::RenderTexture& getCacheTexture(const sf::Vector2u& size);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the cache render texture
+		/// \return The cache render texture, nullptr if the light was never cached
+		//////////////////////////////////////////////////////////////////////////
+		const sf::RenderTexture* getCacheTexture() const;
+
 	private:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Compute the shadows of the shapes in world coordinates, unless they were already computed for the pass
+		/// \param shapes The shapes affected by the light
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
+		/// \param pass The render pass
+		/// \param soft True to compute the penumbras and antumbras, false for hard shadows only
+		/// \param stats The counters of the render, increased by the culled shapes
+		//////////////////////////////////////////////////////////////////////////
+		void updateShadows(const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int convexSilhouetteThreshold, unsigned int pass, bool soft, RenderStats& stats);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get an order independent signature of shapes
+		/// A shape entering, leaving or changing changes it
+		/// \param shapes The shapes
+		/// \return The signature
+		//////////////////////////////////////////////////////////////////////////
+		std::size_t getShapesSignature(const std::vector<priv::QuadtreeOccupant*>& shapes) const;
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Get the cast center of the light
 		/// \return The current cast center
 		//////////////////////////////////////////////////////////////////////////
 		sf::Vector2f getCastCenter() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Remove the shapes which are fully in the umbra of nearer shapes
+		/// Shapes are sorted by distance and tested against a 1D angular coverage buffer around the cast center
+		/// \param casters The shapes casting shadows, the hidden ones are removed
+		/// \return The number of removed shapes
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int cullOccludedShapes(std::vector<LightShape*>& casters) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the silhouette points of a convex shape seen from the cast center, for hard shadows
+		/// \param first The first silhouette point
+		/// \param second The second silhouette point
+		/// \param shape The convex shape
+		/// \param castCenter The cast center
+		/// \return True if the shape has two silhouette points, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool getHardBoundaries(sf::Vector2f& first, sf::Vector2f& second, const LightShape& shape, const sf::Vector2f& castCenter) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether a shape is in the effective radius of the light
+		/// \param shape The shape
+		/// \param castCenter The cast center
+		/// \return True if the shape touches the circle, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isInRadius(const LightShape& shape, const sf::Vector2f& castCenter) const;
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Get penumbras point from a point
 		/// \param penumbras The penumbras
@@ -228,8 +375,47 @@ class LightPointEmission : public priv::QuadtreeOccupant, public priv::BaseLight
 		/// \param outerBoundaryIndices The outer boundary indices
 		/// \param outerBoundaryVectors The outer boundary vectors
 		/// \param shape The shape
+		/// \param convexSilhouetteThreshold Number of points from which the boundaries of convex shapes are binary searched
+		//////////////////////////////////////////////////////////////////////////
+		void getPenumbrasPoint(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape, unsigned int convexSilhouetteThreshold);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether a side of a shape is facing the light
+		/// \param facingFrontBothEdges Is the side facing both edges of the source ?
+		/// \param facingFrontOneEdge Is the side facing at least one edge of the source ?
+		/// \param shape The shape
+		/// \param index The index of the side (from the point index to the next point)
+		/// \param sourceCenter The cast center
 		//////////////////////////////////////////////////////////////////////////
-		void getPenumbrasPoint(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape);
+		void getFacing(bool& facingFrontBothEdges, bool& facingFrontOneEdge, const LightShape& shape, int index, const sf::Vector2f& sourceCenter) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the boundaries of a convex shape, searching around its tangent points
+		/// \param innerBoundaryIndices The inner boundary indices
+		/// \param bothEdgesBoundaryWindings The windings of the inner boundaries
+		/// \param outerBoundaryIndices The outer boundary indices
+		/// \param oneEdgeBoundaryWindings The windings of the outer boundaries
+		/// \param shape The shape
+		/// \param sourceCenter The cast center
+		/// \return True if the boundaries were found, false if the shape has to be walked entirely
+		//////////////////////////////////////////////////////////////////////////
+		bool getConvexBoundaries(std::vector<int>& innerBoundaryIndices, std::vector<bool>& bothEdgesBoundaryWindings, std::vector<int>& outerBoundaryIndices, std::vector<bool>& oneEdgeBoundaryWindings, const LightShape& shape, const sf::Vector2f& sourceCenter) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Shadow of a convex shape, independent of the view
+		//////////////////////////////////////////////////////////////////////////
+		struct Shadow
+		{
+			LightShape* _shape; ///< The convex shape
+			sf::Vector2f _outerStart; ///< The first point of the outer boundary
+			sf::Vector2f _outerEnd; ///< The second point of the outer boundary
+			sf::Vector2f _outerStartVector; ///< The direction of the shadow from the first point
+			sf::Vector2f _outerEndVector; ///< The direction of the shadow from the second point
+			std::vector<priv::Penumbra> _penumbras; ///< The penumbras
+			bool _antumbra; ///< Do the outer boundaries intersect ?
+			std::vector<sf::Vector2f> _maskPoints; ///< The umbra of an antumbra shadow
+			std::vector<sf::Vector2f> _regionPoints; ///< The umbra and penumbras points of an antumbra shadow
+		};
 
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Draw the light
@@ -246,6 +432,24 @@ class LightPointEmission : public priv::QuadtreeOccupant, public priv::BaseLight
 		float mSourceRadius; ///< The source radius
 
 		float mShadowOverExtendMultiplier; ///< The shadow over extend multiplier
+
+		float mRadius; ///< The effective radius, 0 to use the whole AABB box
+
+		sf::VertexArray mMaskVertices; ///< The hard shadow masks of the shapes, drawn at once
+		priv::AntumbraPacker mAntumbraPacker; ///< The antumbras of the shapes, packed in the antumbra texture
+		std::vector<Shadow> mShadows; ///< The shadows of the shapes, shared by the views of a pass
+		unsigned int mShadowsPass; ///< The pass the shadows were computed for
+		bool mShadowsSoft; ///< Were the shadows computed with penumbras ?
+
+		bool mCastShadows; ///< Does the light cast shadows ?
+
+		bool mStatic; ///< Is the light cached ?
+		bool mCacheDirty; ///< Do a property of the light which is not its AABB box changed ?
+		std::size_t mCacheVersion; ///< The version of the light the cache was rendered from
+		std::size_t mCacheSignature; ///< The signature of the shapes the cache was rendered from
+		unsigned int mCacheRenderFrame; ///< The frame the cache was rendered in
+		unsigned int mCacheUseFrame; ///< The last frame the cache was composited in
+		std::unique_ptr<sf::RenderTexture> mCacheTexture; ///< The cached shadowed light
 };
 
 } // namespace ltbl
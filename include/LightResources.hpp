@@ -20,6 +20,19 @@ const std::string unshadowFragment = "" \
     "gl_FragColor = vec4(vec3(1.0 - shadow), 1.0);" \
 "}";
 
+// Variant of the unshadow shader for batched penumbras : the light and dark brightness are in the red and green of the vertex color
+const std::string unshadowBatchFragment = "" \
+"uniform sampler2D penumbraTexture;" \
+"" \
+"void main()" \
+"{" \
+    "float lightBrightness = gl_Color.r;" \
+    "float darkBrightness = gl_Color.g;" \
+    "float penumbra = texture2D(penumbraTexture, gl_TexCoord[0].xy).x;" \
+    "float shadow = (lightBrightness - darkBrightness) * penumbra + darkBrightness;" \
+    "gl_FragColor = vec4(vec3(1.0 - shadow), 1.0);" \
+"}";
+
 const std::string lightOverShapeFragment = "" \
 "uniform sampler2D emissionTexture;" \
 "uniform vec2 targetSizeInv;" \
@@ -38,11 +51,12 @@ const std::string normalFragment = "" \
 "uniform vec2 lightSize;" \
 "uniform vec3 lightPosition;" \
 "uniform vec3 lightColor;" \
+"uniform vec2 normalsOffset;" \
 "void main()" \
 "{" \
 "	vec2 coord = gl_TexCoord[0].xy;" \
 "	float lightPower = texture2D(lightTexture, coord).r;" \
-"	vec4 normalsColor = texture2D(normalsTexture, gl_FragCoord.xy / targetSize);" \
+"	vec4 normalsColor = texture2D(normalsTexture, (gl_FragCoord.xy + normalsOffset) / targetSize);" \
 "	vec3 normals = normalize(normalsColor.rgb * 2.0 - 1.0);" \
 "	vec2 lightVector = lightPosition.xy - gl_FragCoord.xy;" \
 "	vec3 lightDir = vec3(lightVector / lightSize, lightPosition.z);" \
@@ -52,6 +66,65 @@ const std::string normalFragment = "" \
 "	gl_FragColor = clamp(diffuse, 0.0, 1.0);" \
 "}";
 
+const std::string tiledLightFragment = "" \
+"uniform sampler2D dataTexture;" \
+"uniform sampler2D lightTexture;" \
+"uniform vec2 dataSize;" \
+"uniform vec2 lightTextureSizeInv;" \
+"uniform float targetHeight;" \
+"uniform float tileSize;" \
+"uniform float tileCountX;" \
+"uniform float tableStart;" \
+"uniform float indexStart;" \
+"" \
+"vec4 fetch(float index)" \
+"{" \
+"	float row = floor(index / dataSize.x);" \
+"	return texture2D(dataTexture, (vec2(index - row * dataSize.x, row) + 0.5) / dataSize);" \
+"}" \
+"" \
+"float unpack(vec2 bytes)" \
+"{" \
+"	return floor(bytes.x * 255.0 + 0.5) * 256.0 + floor(bytes.y * 255.0 + 0.5);" \
+"}" \
+"" \
+"vec2 unpackSigned(vec4 texel)" \
+"{" \
+"	return (vec2(unpack(texel.rg), unpack(texel.ba)) - 32768.0) * 0.25;" \
+"}" \
+"" \
+"void main()" \
+"{" \
+"	vec2 pixel = vec2(gl_FragCoord.x, targetHeight - gl_FragCoord.y);" \
+"	vec2 tile = floor(pixel / tileSize);" \
+"	vec4 entry = fetch(tableStart + tile.x + tile.y * tileCountX);" \
+"	float offset = unpack(entry.rg);" \
+"	float count = unpack(entry.ba);" \
+"	vec3 color = vec3(0.0);" \
+"	for (float i = 0.0; i < count; i += 1.0)" \
+"	{" \
+"		float slot = offset + i;" \
+"		vec4 pair = fetch(indexStart + floor(slot * 0.5));" \
+"		float light = (mod(slot, 2.0) < 0.5 ? unpack(pair.rg) : unpack(pair.ba)) * 6.0;" \
+"		vec2 origin = unpackSigned(fetch(light));" \
+"		vec2 axisU = unpackSigned(fetch(light + 1.0));" \
+"		vec2 axisV = unpackSigned(fetch(light + 2.0));" \
+"		vec2 d = pixel - origin;" \
+"		float det = axisU.x * axisV.y - axisU.y * axisV.x;" \
+"		if (det != 0.0)" \
+"		{" \
+"			vec2 uv = vec2(d.x * axisV.y - d.y * axisV.x, axisU.x * d.y - axisU.y * d.x) / det;" \
+"			if (uv.x >= 0.0 && uv.x <= 1.0 && uv.y >= 0.0 && uv.y <= 1.0)" \
+"			{" \
+"				vec2 texCoords = unpackSigned(fetch(light + 3.0)) + uv * unpackSigned(fetch(light + 4.0));" \
+"				vec4 texel = texture2D(lightTexture, texCoords * lightTextureSizeInv) * fetch(light + 5.0);" \
+"				color += texel.rgb * texel.a;" \
+"			}" \
+"		}" \
+"	}" \
+"	gl_FragColor = vec4(color, 1.0);" \
+"}";
+
 const unsigned char penumbraTexture[] = { 137,80,78,71,13,10,26,10,0,0,0,13,73,72,68,82,0,0,2,0,0,0,2,0,8,3,0,0,0,195,166,36,200,0,0,3,0,80,76,84,69,0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5,5,5,6,
 6,6,7,7,7,8,8,8,9,9,9,10,10,10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15,16,16,16,17,17,17,18,18,18,19,19,19,20,20,20,21,21,21,22,22,22,23,23,23,24,24,24,25,25,25,26,26,26,27,27,27,28,28,28,29,29,29,30,30,30,31,31,31,32,32,32,33,33,33,34,34,34,35,35,35,36,36,36,37,37,37,38,38,38,39,39,
 39,40,40,40,41,41,41,42,42,42,43,43,43,44,44,44,45,45,45,46,46,46,47,47,47,48,48,48,49,49,49,50,50,50,51,51,51,52,52,52,53,53,53,54,54,54,55,55,55,56,56,56,57,57,57,58,58,58,59,59,59,60,60,60,61,61,61,62,62,62,63,63,63,64,64,64,65,65,65,66,66,66,67,67,67,68,68,68,69,69,69,70,70,70,71,71,71,72,72,72,
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+
 #include "Utils.hpp"
 
 namespace ltbl
@@ -179,7 +181,93 @@ class LightShape : public priv::QuadtreeOccupant, public priv::BaseLight, public
 		//////////////////////////////////////////////////////////////////////////
 		sf::FloatRect getAABB() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Is the shape convex ?
+		/// The result is cached until the points of the shape change
+		/// \return True if the shape is convex, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isConvex() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the tangent points of the shape from a point, in O(log n)
+		/// The shape must be convex and the point outside of the shape
+		/// \param point The point, in world coordinates
+		/// \param first The index of the first tangent point
+		/// \param second The index of the second tangent point
+		/// \return True if the tangent points were found, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool getTangents(const sf::Vector2f& point, int& first, int& second) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the extreme points of the shape along a direction, in O(log n)
+		/// The shape must be convex
+		/// \param direction The direction, in world coordinates
+		/// \param first The index of the point the most in the direction
+		/// \param second The index of the point the most in the opposite direction
+		/// \return True if the extreme points were found, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool getExtremes(const sf::Vector2f& direction, int& first, int& second) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the number of convex parts of the shape
+		/// Concave shapes are decomposed once into convex parts, which cast the shadows for every light
+		/// The decomposition is cached until the points of the shape change
+		/// Self-intersecting shapes are not decomposed, they cast their shadows as a whole
+		/// \return The number of convex parts, 0 if the shape is convex or not simple
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getConvexPartCount() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get a convex part of the shape
+		/// The part shares the transform, the color and the render light over state of the shape
+		/// \param index The index of the part
+		/// \return The convex part
+		//////////////////////////////////////////////////////////////////////////
+		LightShape& getConvexPart(unsigned int index) const;
+
 	private:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get a point in world coordinates, walking the shape counter clockwise
+		/// \param index The index of the point in the counter clockwise order (can be out of range, it loops)
+		/// \param reversed Are the points of the shape stored clockwise in world coordinates ?
+		/// \return The point
+		//////////////////////////////////////////////////////////////////////////
+		sf::Vector2f getCounterClockwisePoint(int index, bool reversed) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Are the points stored clockwise in world coordinates ?
+		/// \return True if the points are clockwise, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool isClockwise() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Binary search of a tangent point from a point
+		/// \param point The point, in world coordinates
+		/// \param right True to search the right tangent, false to search the left one
+		/// \param reversed Are the points of the shape stored clockwise in world coordinates ?
+		/// \return The counter clockwise index of the tangent point, -1 if not found
+		//////////////////////////////////////////////////////////////////////////
+		int searchTangent(const sf::Vector2f& point, bool right, bool reversed) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Binary search of the extreme point along a direction
+		/// \param direction The direction, in world coordinates
+		/// \param reversed Are the points of the shape stored clockwise in world coordinates ?
+		/// \return The counter clockwise index of the extreme point, -1 if not found
+		//////////////////////////////////////////////////////////////////////////
+		int searchExtreme(const sf::Vector2f& direction, bool reversed) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Update the cached convexity and orientation of the shape
+		//////////////////////////////////////////////////////////////////////////
+		void updateConvexity() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Update the convex parts of the shape
+		/// Points are ear clipped, then the triangles are merged while they stay convex (Hertel-Mehlhorn)
+		//////////////////////////////////////////////////////////////////////////
+		void updateConvexParts() const;
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Draw the shape
 		/// \param target The render target to apply the shape on
@@ -190,6 +278,14 @@ class LightShape : public priv::QuadtreeOccupant, public priv::BaseLight, public
 	private:
 		sf::ConvexShape mShape; ///< The shape data
 		bool mRenderLightOver; ///< Do light render over the shape ?
+
+		mutable bool mConvexityChanged; ///< Do the points changed since the convexity was computed ?
+		mutable bool mConvex; ///< Is the shape convex ?
+		mutable bool mLocalClockwise; ///< Are the points stored clockwise in local coordinates ?
+
+		mutable std::vector<std::unique_ptr<LightShape>> mConvexParts; ///< The convex parts of a concave shape
+		mutable bool mConvexPartsChanged; ///< Do the points changed since the convex parts were computed ?
+		mutable std::size_t mConvexPartsVersion; ///< The version of the shape the transform of the parts was copied from
 };
 
 } // namespace ltbl
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "LightPointEmission.hpp"
 #include "LightResources.hpp"
 #include "Sprite.hpp"
+#include "TileMap.hpp"
 
 namespace ltbl
 {
@@ -33,6 +34,14 @@ class LightSystem : sf::NonCopyable
 		//////////////////////////////////////////////////////////////////////////
         void render(sf::RenderTarget& target);
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Render the lights with several views, for split screens or minimaps
+		/// The quadtrees, the queries of the shapes and the shadows of the point lights are computed once for all the views
+		/// The views are rendered one after the other in the same render textures, each one only covers its viewport
+		/// \param views The render targets with the view to render the lights with
+		//////////////////////////////////////////////////////////////////////////
+		void render(const std::vector<std::pair<sf::RenderTarget*, sf::View>>& views);
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Create a light shape
 		/// \return The new light shape
@@ -74,12 +83,37 @@ class LightSystem : sf::NonCopyable
 		//////////////////////////////////////////////////////////////////////////
 		LightShape* createLightShape(const sf::Sprite& sprite);
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Create a light shape
+		/// The polygon can be concave, it is then decomposed into convex parts once
+		/// \param points The points of a simple polygon
+		/// \return The new light shape
+		//////////////////////////////////////////////////////////////////////////
+		LightShape* createLightShape(const std::vector<sf::Vector2f>& points);
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Remove a light shape
 		/// \param shape The light shape to remove
 		//////////////////////////////////////////////////////////////////////////
 		void removeShape(LightShape* shape);
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Create a tile map, its solid tiles are merged into few light shapes
+		/// \param tiles The occupancy of the tiles, row by row (true for solid tiles)
+		/// \param size The number of tiles on each axis
+		/// \param tileSize The size of a tile
+		/// \param position The position of the top left corner of the grid
+		/// \param chunkSize The number of tiles on each axis of a chunk, merged again when one of its tiles changes
+		/// \return The new tile map
+		//////////////////////////////////////////////////////////////////////////
+		TileMap* createTileMap(const std::vector<bool>& tiles, const sf::Vector2u& size, const sf::Vector2f& tileSize, const sf::Vector2f& position = sf::Vector2f(), unsigned int chunkSize = 16);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Remove a tile map and its light shapes
+		/// \param tileMap The tile map to remove
+		//////////////////////////////////////////////////////////////////////////
+		void removeTileMap(TileMap* tileMap);
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Create a light point emission
 		/// \return The new light point emission
@@ -106,6 +140,7 @@ class LightSystem : sf::NonCopyable
 
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Add a sprite
+		/// Its normals are drawn if it is in the view, at the place it was last rendered
 		/// \param sprite The new sprite
 		//////////////////////////////////////////////////////////////////////////
 		void addSprite(Sprite& sprite);
@@ -158,9 +193,94 @@ class LightSystem : sf::NonCopyable
 		//////////////////////////////////////////////////////////////////////////
 		bool useNormals() const;
 
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the number of points from which the silhouette of convex shapes is binary searched
+		/// Smaller shapes, and concave ones, have all their sides tested
+		/// \param threshold The new threshold
+		//////////////////////////////////////////////////////////////////////////
+		void setConvexSilhouetteThreshold(unsigned int threshold);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the number of points from which the silhouette of convex shapes is binary searched
+		/// \return The current threshold
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getConvexSilhouetteThreshold() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the downscale of the render textures of the lights, relative to the render target
+		/// Soft lights rarely need the full resolution, the composition is upsampled bilinearly onto the target
+		/// \param downscale The new downscale : 1 for full resolution, 2 for half, 4 for quarter
+		//////////////////////////////////////////////////////////////////////////
+		void setLightBufferDownscale(unsigned int downscale);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the downscale of the render textures of the lights
+		/// \return The current downscale : 1, 2 or 4
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getLightBufferDownscale() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the number of point lights rendered again each frame
+		/// The other lights are composited from their last render, moving and newly visible lights are always rendered again and do not count against the budget
+		/// \param budget The new budget, 0 to render every light each frame
+		//////////////////////////////////////////////////////////////////////////
+		void setLightUpdateBudget(unsigned int budget);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the number of point lights rendered again each frame
+		/// \return The current budget, 0 if every light is rendered each frame
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getLightUpdateBudget() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the on screen size below which point lights only cast hard shadows
+		/// Hard shadows have no penumbra, no antumbra and don't render the light over shapes
+		/// Static and amortized lights are rendered once for many frames, they always cast soft shadows
+		/// \param size The new size in pixels of the target, on the biggest side of the light, 0 to disable
+		//////////////////////////////////////////////////////////////////////////
+		void setHardShadowSize(float size);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the on screen size below which point lights only cast hard shadows
+		/// \return The current size in pixels of the target, 0 if disabled
+		//////////////////////////////////////////////////////////////////////////
+		float getHardShadowSize() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the on screen size below which point lights cast no shadow
+		/// \param size The new size in pixels of the target, on the biggest side of the light, 0 to disable
+		//////////////////////////////////////////////////////////////////////////
+		void setNoShadowSize(float size);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the on screen size below which point lights cast no shadow
+		/// \return The current size in pixels of the target, 0 if disabled
+		//////////////////////////////////////////////////////////////////////////
+		float getNoShadowSize() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the size of the tiles of the lights without shadows
+		/// The light render texture is split in tiles, each tile evaluates only the lights touching it, in one shader pass per light texture
+		/// \param size The new size of the tiles in pixels of the light render texture, 0 to add the lights as batched quads
+		//////////////////////////////////////////////////////////////////////////
+		void setLightTileSize(unsigned int size);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the size of the tiles of the lights without shadows
+		/// \return The current size of the tiles, 0 if the lights are added as batched quads
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getLightTileSize() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the counters of the last render
+		/// \return The counters of the last render
+		//////////////////////////////////////////////////////////////////////////
+		const RenderStats& getRenderStats() const;
+
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Update shader texture and the size of render texture
 		/// Call it only if you change the penumbra texture or shaders, render texture size are automatically updated
+		/// The render textures only grow, smaller sizes are rendered in their top left part
 		/// \param size The new size for render texture, don't call it with this parameter yourself !
 		//////////////////////////////////////////////////////////////////////////
 		void update(const sf::Vector2u& size = sf::Vector2u());
@@ -177,6 +297,8 @@ class LightSystem : sf::NonCopyable
 		//////////////////////////////////////////////////////////////////////////
 		/// \brief Get the unshadow shader
 		/// As unshadow shader if automatically loaded, use it only to change the shader
+		/// The penumbras are batched : the light and dark brightness are given in the red and green of the vertex color (see priv::unshadowBatchFragment)
+		/// The lightBrightness and darkBrightness uniforms of priv::unshadowFragment are not set anymore, custom shaders must read the vertex color
 		/// You have to call update(), right after you changed it
 		/// \return The unshadow shader
 		//////////////////////////////////////////////////////////////////////////
@@ -198,29 +320,187 @@ class LightSystem : sf::NonCopyable
 		//////////////////////////////////////////////////////////////////////////
 		sf::Shader& getNormalsShader();
 
+	private:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Render the lights with one view
+		/// \param target The render target to render the lights on
+		/// \param targetView The view to render the lights with
+		//////////////////////////////////////////////////////////////////////////
+		void renderView(sf::RenderTarget& target, const sf::View& targetView);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the shapes in the AABB box of a point light, queried once by pass
+		/// \param light The light
+		/// \return The shapes, none if the light doesn't cast shadows
+		//////////////////////////////////////////////////////////////////////////
+		const std::vector<priv::QuadtreeOccupant*>& queryLightShapes(LightPointEmission& light);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Add the batched lights without shadows to the composition, one draw per texture
+		/// \param view The current view
+		//////////////////////////////////////////////////////////////////////////
+		void renderEmissionBatches(const sf::View& view);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Add lights without shadows sharing a texture to the composition, with the tiled light shader
+		/// The lights are binned in tiles on the CPU, their data and the lists of the tiles are packed in the light tile texture
+		/// \param texture The texture of the lights
+		/// \param vertices The quads of the lights, as two triangles each
+		/// \param view The current view
+		/// \return False if the lights don't fit in the tile texture and must be drawn as quads, true otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool renderTiledEmissions(const sf::Texture& texture, const sf::VertexArray& vertices, const sf::View& view);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Composite the lights waiting for the update budget, rendering again the ones with the highest priority
+		/// \param view The current view
+		//////////////////////////////////////////////////////////////////////////
+		void renderAmortizedLights(const sf::View& view);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Render the shadowed light of a light in its cache
+		/// \param light The light
+		/// \param shapes The shapes in the AABB box of the light
+		//////////////////////////////////////////////////////////////////////////
+		void renderLightCache(LightPointEmission& light, const std::vector<priv::QuadtreeOccupant*>& shapes);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Composite a light from its cache
+		/// \param light The light
+		/// \param view The current view
+		//////////////////////////////////////////////////////////////////////////
+		void compositeLightCache(LightPointEmission& light, const sf::View& view);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Composite a directional light from its shadow tiles under the view, rendering the outdated ones again
+		/// \param light The light
+		/// \param view The current view
+		//////////////////////////////////////////////////////////////////////////
+		void renderShadowTiles(LightDirectionEmission& light, const sf::View& view);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Render the lights pending in the atlas, composite them, and empty it
+		//////////////////////////////////////////////////////////////////////////
+		void flushLightAtlas();
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Render the emission of the pending lights which need it in their slots, in one pass
+		//////////////////////////////////////////////////////////////////////////
+		void renderPendingEmissions();
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Update the normals render texture
+		/// It is redrawn entirely when the view changed, otherwise only where sprites changed, appeared or disappeared
+		/// The sprites drawn are the ones of the pass under the view, their render flags are not read here
+		/// \param view The current view
+		/// \param viewBounds The bounds of the view
+		//////////////////////////////////////////////////////////////////////////
+		void renderNormals(const sf::View& view, const sf::FloatRect& viewBounds);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Choose the level of detail of the shadows of a point light
+		/// \param light The light
+		/// \param view The current view
+		/// \return The level of detail for the on screen size of the light, including its part out of the screen
+		//////////////////////////////////////////////////////////////////////////
+		priv::ShadowLod getShadowLod(const LightPointEmission& light, const sf::View& view) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Tell whether the emission of a light is sampled by its shapes
+		/// \param shapes The shapes in the AABB box of the light
+		/// \return True if a shape renders the light over it, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool needsEmission(const std::vector<priv::QuadtreeOccupant*>& shapes) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Sprite whose normals are in the normals render texture
+		//////////////////////////////////////////////////////////////////////////
+		struct DrawnNormals
+		{
+			sf::FloatRect _bounds; ///< The bounds of the sprite when it was drawn
+			std::size_t _version; ///< The normals version of the sprite when it was drawn
+			unsigned int _frame; ///< The last pass which found the sprite
+		};
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Shapes in the AABB box of a point light
+		//////////////////////////////////////////////////////////////////////////
+		struct LightShapesQuery
+		{
+			unsigned int _pass; ///< The pass the shapes were queried in
+			std::vector<priv::QuadtreeOccupant*> _shapes; ///< The shapes
+		};
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Point light waiting in the atlas to be rendered
+		//////////////////////////////////////////////////////////////////////////
+		struct PendingLight
+		{
+			LightPointEmission* _light; ///< The light
+			sf::IntRect _footprint; ///< The pixels of the light on the screen
+			sf::IntRect _slot; ///< The pixels of the light in the atlas
+			sf::View _view; ///< The view drawing the footprint in the slot
+			std::size_t _firstShape; ///< The index of the first shape of the light in the pending shapes
+			std::size_t _shapeCount; ///< The number of shapes of the light
+			bool _emission; ///< Does the light need its emission ?
+			priv::ShadowLod _lod; ///< The level of detail of the shadows
+		};
+
 	private:
 		sf::Texture mPenumbraTexture; ///< The penumbra texture, loaded from memory when the system is created
 		sf::Shader mUnshadowShader; ///< The unshadow shader, loaded from memory when the system is created
 		sf::Shader mLightOverShapeShader; ///< The light over shape shader, loaded from memory when the system is created
 		sf::Shader mNormalsShader; ///< The normal shader
+		sf::Shader mLightTileShader; ///< The tiled light shader, loaded from memory when the system is created
 
 		priv::Quadtree mLightShapeQuadtree; ///< The quadtree which handles LightShape
 		priv::Quadtree mLightPointEmissionQuadtree; ///< The quadtree which handles LightPointEmission
+		priv::Quadtree mNormalSpriteQuadtree; ///< The quadtree which handles the NormalSprites
 
 		std::unordered_set<LightPointEmission*> mPointEmissionLights; ///< The LightPointEmissions of the system
 		std::unordered_set<LightDirectionEmission*> mDirectionEmissionLights; ///< The LightDirectionEmissions of the system
 		std::unordered_set<LightShape*> mLightShapes; ///< The LightShapes of the system
 		std::unordered_set<Sprite*> mNormalSprites; ///< The NormalSprites of the system
+		std::unordered_set<TileMap*> mTileMaps; ///< The TileMaps of the system
 
 		sf::RenderTexture mLightTempTexture; ///< The light render texture
 		sf::RenderTexture mEmissionTempTexture; ///< The emission render texture
 		sf::RenderTexture mAntumbraTempTexture; ///< The antumbra render texture
 		sf::RenderTexture mCompositionTexture; ///< The composition render texture
-		sf::RenderTexture mNormalsTexture; ///< The normal render texture
+		sf::RenderTexture mNormalsTexture; ///< The normal render texture, only created when the system uses normals
+		sf::Vector2u mBufferSize; ///< The used part of the render textures, which may be bigger
+		std::unordered_map<const sf::Texture*, sf::VertexArray> mNormalsBatches; ///< The quads of the visible sprites, by normals texture
+		sf::View mNormalsView; ///< The view the normals render texture was drawn with
+		bool mNormalsValid; ///< Can the normals render texture be updated incrementally ?
+		unsigned int mNormalsFrame; ///< The number of normals passes
+		std::unordered_map<Sprite*, DrawnNormals> mDrawnNormals; ///< The sprites in the normals render texture
+		sf::FloatRect mNormalsDirty; ///< The area to redraw in the normals render texture
+		bool mNormalsDirtyEmpty; ///< Is there nothing to redraw ?
+		std::vector<Sprite*> mRenderedNormals; ///< The visible sprites rendered since the last pass, read once for all the views
 
 		float mDirectionEmissionRange; ///< The direction emission range
 		float mDirectionEmissionRadiusMultiplier; ///< The dreiction emission radius multiplier
 		sf::Color mAmbientColor; ///< The ambient color
+		unsigned int mConvexSilhouetteThreshold; ///< The number of points from which the silhouette of convex shapes is binary searched
+		unsigned int mLightBufferDownscale; ///< The downscale of the render textures, relative to the target
+		unsigned int mLightUpdateBudget; ///< The number of point lights rendered again each frame, 0 for all
+		unsigned int mLightUpdates; ///< The point lights rendered again within the budget in the current pass
+		float mHardShadowSize; ///< The on screen size below which point lights cast hard shadows, 0 to disable
+		float mNoShadowSize; ///< The on screen size below which point lights cast no shadow, 0 to disable
+		unsigned int mLightTileSize; ///< The size of the tiles of the lights without shadows, 0 to disable
+		unsigned int mFrameCount; ///< The number of renders
+		RenderStats mRenderStats; ///< The counters of the last render
+
+		priv::ShelfPacker mLightAtlas; ///< The slots of the point lights in the light render texture
+		sf::VertexArray mLightAtlasVertices; ///< The quads compositing the lights of the atlas
+		std::vector<PendingLight> mPendingLights; ///< The lights of the atlas, rendered when it is flushed
+		std::vector<priv::QuadtreeOccupant*> mPendingShapes; ///< The shapes of the pending lights, one after the other
+		std::unordered_map<const sf::Texture*, sf::VertexArray> mEmissionBatches; ///< The quads of the visible lights without shadows, by texture
+		sf::Texture mLightTileTexture; ///< The data of the tiled lights and the lists of the tiles
+		std::vector<sf::Uint8> mLightTileData; ///< The pixels of the light tile texture
+		sf::VertexArray mLightTileVertices; ///< The quads of the tiles touched by a light
+		std::vector<std::pair<float, LightPointEmission*>> mAmortizedLights; ///< The lights waiting for the update budget, with their priority
+		std::unordered_map<const LightPointEmission*, LightShapesQuery> mLightShapesQueries; ///< The shapes of the point lights in the current pass
 
 		const bool mUseNormals; ///< Do the system use normals ?
 };
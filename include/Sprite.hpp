@@ -8,7 +8,7 @@ namespace ltbl
 //////////////////////////////////////////////////////////////////////////
 /// \brief Sprite with normals
 //////////////////////////////////////////////////////////////////////////
-class Sprite : public priv::BaseLight, public sf::Sprite
+class Sprite : public priv::QuadtreeOccupant, public priv::BaseLight, public sf::Sprite
 {
 	public:
 		Sprite();
@@ -22,10 +22,31 @@ class Sprite : public priv::BaseLight, public sf::Sprite
 		void render(sf::RenderTarget& target, sf::RenderStates states = sf::RenderStates());
 		void renderNormals(sf::RenderTarget& target, sf::RenderStates states = sf::RenderStates());
 
+		// Append the normals quad to a batch of the same normals texture
+		void appendNormals(sf::VertexArray& vertices) const;
+
+		// Tell whether the sprite was rendered since the last call, and reset it
+		bool consumeRenderNormals();
+
+		// Version stamp of what the normals look like, changed by render when the sprite changed
+		std::size_t getNormalsVersion() const;
+
+		// Notify the quadtree if the sprite moved, called by render
+		void updateAABB();
+
+		sf::FloatRect getAABB() const;
+
 	private:
 		sf::Texture* mTexture;
 		sf::Texture* mNormalsTexture;
 		bool mNeedRenderNormals;
+		sf::FloatRect mAABB;
+
+		std::size_t mNormalsVersion;
+		sf::Transform mNormalsTransform;
+		sf::IntRect mNormalsRect;
+		sf::Color mNormalsColor;
+		const sf::Texture* mNormalsTextureUsed;
 };
 
 } // namespace ltbl
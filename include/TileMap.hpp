@@ -0,0 +1,90 @@
+#pragma once
+
+#include "LightShape.hpp"
+
+namespace ltbl
+{
+
+class LightSystem;
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Grid of solid tiles, merged into few rectangle light shapes
+/// The grid is split in chunks, only the chunks with changed tiles are merged again
+//////////////////////////////////////////////////////////////////////////
+class TileMap : sf::NonCopyable
+{
+	public:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Constructor
+		/// \param system The light system which owns the light shapes
+		/// \param tiles The occupancy of the tiles, row by row (true for solid tiles)
+		/// \param size The number of tiles on each axis
+		/// \param tileSize The size of a tile
+		/// \param position The position of the top left corner of the grid
+		/// \param chunkSize The number of tiles on each axis of a chunk
+		//////////////////////////////////////////////////////////////////////////
+		TileMap(LightSystem& system, const std::vector<bool>& tiles, const sf::Vector2u& size, const sf::Vector2f& tileSize, const sf::Vector2f& position, unsigned int chunkSize);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Destructor, remove the light shapes from the system
+		//////////////////////////////////////////////////////////////////////////
+		~TileMap();
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Set the occupancy of a tile
+		/// The chunk of the tile is merged again on the next update
+		/// \param x The X coordinate of the tile
+		/// \param y The Y coordinate of the tile
+		/// \param solid True if the tile is solid, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		void setTile(unsigned int x, unsigned int y, bool solid);
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the occupancy of a tile
+		/// \param x The X coordinate of the tile
+		/// \param y The Y coordinate of the tile
+		/// \return True if the tile is solid, false otherwise
+		//////////////////////////////////////////////////////////////////////////
+		bool getTile(unsigned int x, unsigned int y) const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the number of tiles on each axis
+		/// \return The size of the grid
+		//////////////////////////////////////////////////////////////////////////
+		const sf::Vector2u& getSize() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the number of light shapes the tiles are merged into
+		/// \return The number of light shapes
+		//////////////////////////////////////////////////////////////////////////
+		unsigned int getShapeCount() const;
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Merge again the chunks with changed tiles
+		/// Called by the light system before rendering
+		//////////////////////////////////////////////////////////////////////////
+		void update();
+
+	private:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Replace the light shapes of a chunk by greedily merged rectangles
+		/// \param chunk The index of the chunk
+		//////////////////////////////////////////////////////////////////////////
+		void mergeChunk(unsigned int chunk);
+
+	private:
+		LightSystem& mSystem; ///< The light system which owns the light shapes
+
+		std::vector<bool> mTiles; ///< The occupancy of the tiles, row by row
+		sf::Vector2u mSize; ///< The number of tiles on each axis
+		sf::Vector2f mTileSize; ///< The size of a tile
+		sf::Vector2f mPosition; ///< The position of the top left corner of the grid
+
+		unsigned int mChunkSize; ///< The number of tiles on each axis of a chunk
+		sf::Vector2u mChunkCount; ///< The number of chunks on each axis
+		std::vector<std::vector<LightShape*>> mChunkShapes; ///< The light shapes of each chunk
+		std::vector<bool> mDirtyChunks; ///< The chunks to merge again
+		bool mDirty; ///< Is there any chunk to merge again ?
+};
+
+} // namespace ltbl
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <functional>
+#include <limits>
 #include <list>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -12,6 +16,22 @@
 namespace ltbl
 {
 
+//////////////////////////////////////////////////////////////////////////
+/// \brief Counters of the last render of a light system
+//////////////////////////////////////////////////////////////////////////
+struct RenderStats
+{
+	unsigned int _culledShapes; ///< The shapes out of the radius of the lights
+	unsigned int _occludedShapes; ///< The shapes hidden in the umbra of nearer shapes
+	unsigned int _offscreenShapes; ///< The shapes whose body and shadow are out of the visible part of the lights
+	unsigned int _drawCalls; ///< The draw calls issued by the light system
+	unsigned int _cachedLights; ///< The static lights composited from their cache without being rendered again
+	unsigned int _cachedShadowTiles; ///< The shadow tiles of directional lights composited without being rendered again
+	unsigned int _batchedLights; ///< The point lights without shadows, added to the composition by texture
+	unsigned int _batchedMasks; ///< The hard shadow masks drawn in a batch, each one was a draw call before
+	unsigned int _maskBatches; ///< The draw calls of the batched hard shadow masks
+};
+
 namespace priv
 {
 
@@ -62,6 +82,13 @@ inline sf::FloatRect rectFromBounds(const sf::Vector2f& lowerBound, const sf::Ve
 	return sf::FloatRect(lowerBound.x, lowerBound.y, upperBound.x - lowerBound.x, upperBound.y - lowerBound.y);
 }
 
+inline sf::FloatRect rectUnion(const sf::FloatRect& rect, const sf::FloatRect& other)
+{
+	sf::Vector2f lowerBound(std::min(rect.left, other.left), std::min(rect.top, other.top));
+	sf::Vector2f upperBound(std::max(rect.left + rect.width, other.left + other.width), std::max(rect.top + rect.height, other.top + other.height));
+	return rectFromBounds(lowerBound, upperBound);
+}
+
 inline sf::FloatRect rectRecenter(const sf::FloatRect& rect, const sf::Vector2f& center)
 {
 	sf::Vector2f dims = rectDims(rect);
@@ -92,6 +119,11 @@ inline float vectorDot(const sf::Vector2f& left, const sf::Vector2f& right)
 	return left.x * right.x + left.y * right.y;
 }
 
+inline float vectorCross(const sf::Vector2f& left, const sf::Vector2f& right)
+{
+	return left.x * right.y - left.y * right.x;
+}
+
 inline float vectorProject(const sf::Vector2f& left, const sf::Vector2f& right)
 {
 	assert(vectorMagnitudeSquared(right) != 0.0f);
@@ -188,6 +220,78 @@ inline bool rayIntersect(const sf::Vector2f& as, const sf::Vector2f& ad, const s
 	return true;
 }
 
+inline float segmentDistance(const sf::Vector2f& point, const sf::Vector2f& a, const sf::Vector2f& b)
+{
+	sf::Vector2f segment = b - a;
+	float lengthSquared = vectorMagnitudeSquared(segment);
+	float t = (lengthSquared > 0.0f) ? std::max(0.0f, std::min(1.0f, vectorDot(point - a, segment) / lengthSquared)) : 0.0f;
+	return vectorMagnitude(point - (a + segment * t));
+}
+
+inline bool segmentsCross(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, const sf::Vector2f& d)
+{
+	float ac = vectorCross(b - a, c - a);
+	float ad = vectorCross(b - a, d - a);
+	float ca = vectorCross(d - c, a - c);
+	float cb = vectorCross(d - c, b - c);
+	return ((ac < 0.0f && ad > 0.0f) || (ac > 0.0f && ad < 0.0f)) && ((ca < 0.0f && cb > 0.0f) || (ca > 0.0f && cb < 0.0f));
+}
+
+inline bool hullIntersectsRect(const std::vector<sf::Vector2f>& points, const sf::FloatRect& rect)
+{
+	// Separating axes : the axes of the rect, and the normals of every pair of points (the edges of the hull are among them)
+	sf::Vector2f corners[4] = { rectLowerBound(rect), { rect.left + rect.width, rect.top }, rectUpperBound(rect), { rect.left, rect.top + rect.height } };
+	std::vector<sf::Vector2f> axes = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		for (std::size_t j = i + 1; j < points.size(); j++)
+		{
+			axes.push_back({ points[i].y - points[j].y, points[j].x - points[i].x });
+		}
+	}
+	for (const sf::Vector2f& axis : axes)
+	{
+		float pointsMin = std::numeric_limits<float>::max();
+		float pointsMax = -std::numeric_limits<float>::max();
+		for (const sf::Vector2f& point : points)
+		{
+			pointsMin = std::min(pointsMin, vectorDot(point, axis));
+			pointsMax = std::max(pointsMax, vectorDot(point, axis));
+		}
+		float rectMin = std::numeric_limits<float>::max();
+		float rectMax = -std::numeric_limits<float>::max();
+		for (const sf::Vector2f& corner : corners)
+		{
+			rectMin = std::min(rectMin, vectorDot(corner, axis));
+			rectMax = std::max(rectMax, vectorDot(corner, axis));
+		}
+		if (pointsMax < rectMin || rectMax < pointsMin)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool rectIntersectsCircle(const sf::FloatRect& rect, const sf::Vector2f& center, float radius)
+{
+	float dx = center.x - std::max(rect.left, std::min(center.x, rect.left + rect.width));
+	float dy = center.y - std::max(rect.top, std::min(center.y, rect.top + rect.height));
+	return dx * dx + dy * dy <= radius * radius;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get a new version stamp
+/// Stamps are unique for the whole program, so an object that is destroyed
+/// and replaced at the same address never gets an already used stamp
+/// \return The new stamp
+//////////////////////////////////////////////////////////////////////////
+inline std::size_t nextVersionStamp()
+{
+	static std::size_t stamp = 0;
+	return ++stamp;
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// \brief An occupant of a quadtree
 //////////////////////////////////////////////////////////////////////////
@@ -200,6 +304,7 @@ class QuadtreeOccupant
 		QuadtreeOccupant()
 			: mAwake(true)
 			, mAABBChanged(false)
+			, mVersion(nextVersionStamp())
 		{
 		}
 
@@ -241,11 +346,23 @@ class QuadtreeOccupant
 		void quadtreeAABBChanged()
 		{
 			mAABBChanged = true;
+			mVersion = nextVersionStamp();
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Get the version stamp of the occupant
+		/// The stamp changes each time the AABB box of the occupant changes
+		/// \return The current version stamp
+		//////////////////////////////////////////////////////////////////////////
+		std::size_t getVersion() const
+		{
+			return mVersion;
 		}
 
 	private:
 		bool mAwake; ///< Is the occupant awake ? (ie queryable / updatable by the quadtree)
 		bool mAABBChanged; ///< Do the AABB box changed ?
+		std::size_t mVersion; ///< The version stamp, used by caches to detect changes
 
 	private:
 		friend class Quadtree;
@@ -923,6 +1040,417 @@ struct Penumbra
 	float _distance; ///< The distance
 };
 
+//////////////////////////////////////////////////////////////////////////
+/// \brief Level of detail of the shadows of a point light
+//////////////////////////////////////////////////////////////////////////
+enum class ShadowLod
+{
+	Soft, ///< Penumbras, antumbras and light over shapes
+	Hard, ///< Shadow quads from the cast center only
+	None ///< No shadows at all
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get the pixels covered by a rect, clipped to the viewport of the view
+/// \param target The render target
+/// \param view The view
+/// \param rect The rect, in world coordinates
+/// \return The pixels, empty if the rect is out of the viewport
+//////////////////////////////////////////////////////////////////////////
+inline sf::IntRect rectToPixels(const sf::RenderTarget& target, const sf::View& view, const sf::FloatRect& rect)
+{
+	sf::Vector2f corners[4] = { rectLowerBound(rect), { rect.left + rect.width, rect.top }, rectUpperBound(rect), { rect.left, rect.top + rect.height } };
+	sf::Vector2i lower = target.mapCoordsToPixel(corners[0], view);
+	sf::Vector2i upper = lower;
+	for (const sf::Vector2f& corner : corners)
+	{
+		sf::Vector2i pixel = target.mapCoordsToPixel(corner, view);
+		lower.x = std::min(lower.x, pixel.x);
+		lower.y = std::min(lower.y, pixel.y);
+		upper.x = std::max(upper.x, pixel.x);
+		upper.y = std::max(upper.y, pixel.y);
+	}
+
+	sf::IntRect pixels;
+	if (!sf::IntRect(lower, upper - lower + sf::Vector2i(1, 1)).intersects(target.getViewport(view), pixels))
+	{
+		return sf::IntRect();
+	}
+	return pixels;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get a view showing what some pixels of a view show, but drawing it in other pixels
+/// \param target The render target
+/// \param view The view
+/// \param pixels The pixels of the view to show, inside its viewport
+/// \param destination The pixels to draw in, with the same size
+/// \return The view restricted to the pixels
+//////////////////////////////////////////////////////////////////////////
+inline sf::View viewFromPixels(const sf::RenderTarget& target, const sf::View& view, const sf::IntRect& pixels, const sf::IntRect& destination)
+{
+	sf::IntRect viewport = target.getViewport(view);
+	sf::Vector2f size(static_cast<float>(target.getSize().x), static_cast<float>(target.getSize().y));
+
+	// Center of the pixels, in normalized device coordinates of the view
+	float x = -1.0f + 2.0f * (pixels.left + pixels.width * 0.5f - viewport.left) / viewport.width;
+	float y = 1.0f - 2.0f * (pixels.top + pixels.height * 0.5f - viewport.top) / viewport.height;
+
+	sf::View restricted(view);
+	restricted.setCenter(view.getInverseTransform().transformPoint(x, y));
+	restricted.setSize(view.getSize().x * pixels.width / viewport.width, view.getSize().y * pixels.height / viewport.height);
+	restricted.setViewport(sf::FloatRect(destination.left / size.x, destination.top / size.y, destination.width / size.x, destination.height / size.y));
+	return restricted;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Packs rects in rows (shelves), from the top left corner
+//////////////////////////////////////////////////////////////////////////
+class ShelfPacker
+{
+	public:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Default constructor
+		//////////////////////////////////////////////////////////////////////////
+		ShelfPacker()
+			: mSize()
+			, mShelfTop(0)
+			, mShelfHeight(0)
+			, mCursor(0)
+		{
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Remove every packed rect
+		/// \param size The size of the area to pack in
+		//////////////////////////////////////////////////////////////////////////
+		void reset(const sf::Vector2u& size)
+		{
+			mSize = sf::Vector2i(static_cast<int>(size.x), static_cast<int>(size.y));
+			mShelfTop = 0;
+			mShelfHeight = 0;
+			mCursor = 0;
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Pack a rect
+		/// \param size The size of the rect
+		/// \param slot The place of the packed rect
+		/// \return False if there is no room left for it
+		//////////////////////////////////////////////////////////////////////////
+		bool insert(const sf::Vector2i& size, sf::IntRect& slot)
+		{
+			// Open a new shelf under the current one when the row is full
+			if (mCursor + size.x > mSize.x)
+			{
+				mShelfTop += mShelfHeight;
+				mShelfHeight = 0;
+				mCursor = 0;
+			}
+			if (size.x > mSize.x || mShelfTop + size.y > mSize.y)
+			{
+				return false;
+			}
+
+			slot = sf::IntRect(mCursor, mShelfTop, size.x, size.y);
+			mCursor += size.x;
+			mShelfHeight = std::max(mShelfHeight, size.y);
+			return true;
+		}
+
+	private:
+		sf::Vector2i mSize; ///< The size of the area to pack in
+		int mShelfTop; ///< The top of the current shelf
+		int mShelfHeight; ///< The height of the current shelf
+		int mCursor; ///< The left of the next rect in the current shelf
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Clear some pixels of a render target
+/// The view of the target is left to its default view
+/// \param target The render target
+/// \param pixels The pixels to clear
+/// \param color The clear color
+//////////////////////////////////////////////////////////////////////////
+inline void clearPixels(sf::RenderTarget& target, const sf::IntRect& pixels, const sf::Color& color)
+{
+	sf::RectangleShape shape(sf::Vector2f(static_cast<float>(pixels.width), static_cast<float>(pixels.height)));
+	shape.setPosition(static_cast<float>(pixels.left), static_cast<float>(pixels.top));
+	shape.setFillColor(color);
+	target.setView(target.getDefaultView());
+	target.draw(shape, sf::BlendNone);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get the transform from world coordinates to the pixels of a render target, through a view
+/// Unlike mapCoordsToPixel, the pixels are not rounded
+/// \param target The render target
+/// \param view The view
+/// \return The transform
+//////////////////////////////////////////////////////////////////////////
+inline sf::Transform pixelsFromCoords(const sf::RenderTarget& target, const sf::View& view)
+{
+	sf::IntRect viewport = target.getViewport(view);
+	float halfWidth = viewport.width * 0.5f;
+	float halfHeight = viewport.height * 0.5f;
+	sf::Transform ndcToPixels(halfWidth, 0.0f, viewport.left + halfWidth,
+		0.0f, -halfHeight, viewport.top + halfHeight,
+		0.0f, 0.0f, 1.0f);
+	return ndcToPixels * view.getTransform();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Create a render texture again only if it is smaller than a size
+/// The texture keeps its biggest size, smaller sizes are drawn in its top left part
+/// \param texture The render texture
+/// \param size The size needed
+/// \return True if the texture was created again, false otherwise
+//////////////////////////////////////////////////////////////////////////
+inline bool growRenderTexture(sf::RenderTexture& texture, const sf::Vector2u& size)
+{
+	sf::Vector2u textureSize = texture.getSize();
+	if (textureSize.x >= size.x && textureSize.y >= size.y)
+	{
+		return false;
+	}
+	texture.create(std::max(textureSize.x, size.x), std::max(textureSize.y, size.y));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get the viewport drawing a view in the top left part of a bigger texture
+/// \param viewport The viewport of the view, relative to the used part
+/// \param size The size of the used part of the texture
+/// \param textureSize The size of the texture
+/// \return The viewport relative to the whole texture
+//////////////////////////////////////////////////////////////////////////
+inline sf::FloatRect viewportInTexture(const sf::FloatRect& viewport, const sf::Vector2u& size, const sf::Vector2u& textureSize)
+{
+	float scaleX = size.x / static_cast<float>(textureSize.x);
+	float scaleY = size.y / static_cast<float>(textureSize.y);
+	return sf::FloatRect(viewport.left * scaleX, viewport.top * scaleY, viewport.width * scaleX, viewport.height * scaleY);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get the quad of a textured rect, as sf::Sprite draws it
+/// \param quad The four vertices to fill, in order around the quad
+/// \param transform The transform of the rect
+/// \param textureRect The part of the texture, flipped if its size is negative
+/// \param color The color of the vertices
+//////////////////////////////////////////////////////////////////////////
+inline void spriteQuad(sf::Vertex* quad, const sf::Transform& transform, const sf::IntRect& textureRect, const sf::Color& color)
+{
+	float width = std::abs(static_cast<float>(textureRect.width));
+	float height = std::abs(static_cast<float>(textureRect.height));
+	float left = static_cast<float>(textureRect.left);
+	float top = static_cast<float>(textureRect.top);
+	float right = left + textureRect.width;
+	float bottom = top + textureRect.height;
+	quad[0] = sf::Vertex(transform.transformPoint(0.0f, 0.0f), color, sf::Vector2f(left, top));
+	quad[1] = sf::Vertex(transform.transformPoint(width, 0.0f), color, sf::Vector2f(right, top));
+	quad[2] = sf::Vertex(transform.transformPoint(width, height), color, sf::Vector2f(right, bottom));
+	quad[3] = sf::Vertex(transform.transformPoint(0.0f, height), color, sf::Vector2f(left, bottom));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Append a quad, as two triangles
+/// \param triangles The vertex array to append to
+/// \param quad The four vertices of the quad, in order around it
+//////////////////////////////////////////////////////////////////////////
+inline void appendQuad(sf::VertexArray& triangles, const sf::Vertex* quad)
+{
+	const int fan[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; i++)
+	{
+		triangles.append(quad[fan[i]]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Append the quad of a textured rect, as two triangles
+/// \param triangles The vertex array to append to
+/// \param transform The transform of the rect
+/// \param textureRect The part of the texture, flipped if its size is negative
+/// \param color The color of the vertices
+//////////////////////////////////////////////////////////////////////////
+inline void appendQuad(sf::VertexArray& triangles, const sf::Transform& transform, const sf::IntRect& textureRect, const sf::Color& color)
+{
+	sf::Vertex quad[4];
+	spriteQuad(quad, transform, textureRect, color);
+	appendQuad(triangles, quad);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Append a quad clipped to a rect, as triangles
+/// Positions and texture coordinates are interpolated along the clipped sides
+/// \param triangles The vertex array to append to
+/// \param quad The four vertices of the quad, in order around it
+/// \param clip The rect to clip to
+//////////////////////////////////////////////////////////////////////////
+inline void appendClippedQuad(sf::VertexArray& triangles, const sf::Vertex* quad, const sf::FloatRect& clip)
+{
+	std::vector<sf::Vertex> polygon(quad, quad + 4);
+	std::vector<sf::Vertex> clipped;
+
+	// Sutherland-Hodgman, against each side of the rect : axis, sign and bound
+	const int axes[4] = { 0, 0, 1, 1 };
+	const float signs[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+	const float bounds[4] = { clip.left, clip.left + clip.width, clip.top, clip.top + clip.height };
+	for (int side = 0; side < 4 && !polygon.empty(); side++)
+	{
+		auto distance = [&](const sf::Vertex& vertex)
+		{
+			return signs[side] * ((axes[side] == 0 ? vertex.position.x : vertex.position.y) - bounds[side]);
+		};
+
+		clipped.clear();
+		for (std::size_t i = 0; i < polygon.size(); i++)
+		{
+			const sf::Vertex& current = polygon[i];
+			const sf::Vertex& next = polygon[(i + 1) % polygon.size()];
+			float currentDistance = distance(current);
+			float nextDistance = distance(next);
+			if (currentDistance >= 0.0f)
+			{
+				clipped.push_back(current);
+			}
+			if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+			{
+				float t = currentDistance / (currentDistance - nextDistance);
+				sf::Vertex vertex = current;
+				vertex.position = current.position + (next.position - current.position) * t;
+				vertex.texCoords = current.texCoords + (next.texCoords - current.texCoords) * t;
+				clipped.push_back(vertex);
+			}
+		}
+		polygon.swap(clipped);
+	}
+
+	for (std::size_t i = 1; i + 1 < polygon.size(); i++)
+	{
+		triangles.append(polygon[0]);
+		triangles.append(polygon[i]);
+		triangles.append(polygon[i + 1]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Packs the antumbras of several shapes in the antumbra texture
+/// Each antumbra only touches the pixels of its own region, the regions which
+/// do not overlap share the texture and are multiplied back in one draw
+//////////////////////////////////////////////////////////////////////////
+class AntumbraPacker
+{
+	public:
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Default constructor
+		//////////////////////////////////////////////////////////////////////////
+		AntumbraPacker()
+			: mRegions()
+			, mVertices(sf::Triangles)
+		{
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Start the antumbra of a shape, its region is cleared to white
+		/// The pending antumbras are flushed first if the region overlaps them
+		/// \param lightTexture The light render texture
+		/// \param antumbraTexture The antumbra render texture, its view is set to the given one
+		/// \param view The current view
+		/// \param points The points of the mask and penumbras of the shape, in world coordinates
+		/// \param drawCalls The draw calls counter
+		/// \return False if the region is out of the texture, nothing has to be drawn then
+		//////////////////////////////////////////////////////////////////////////
+		bool begin(sf::RenderTexture& lightTexture, sf::RenderTexture& antumbraTexture, const sf::View& view, const std::vector<sf::Vector2f>& points, unsigned int& drawCalls)
+		{
+			sf::Vector2i lower = antumbraTexture.mapCoordsToPixel(points[0], view);
+			sf::Vector2i upper = lower;
+			for (const sf::Vector2f& point : points)
+			{
+				sf::Vector2i pixel = antumbraTexture.mapCoordsToPixel(point, view);
+				lower.x = std::min(lower.x, pixel.x);
+				lower.y = std::min(lower.y, pixel.y);
+				upper.x = std::max(upper.x, pixel.x);
+				upper.y = std::max(upper.y, pixel.y);
+			}
+
+			// One pixel of margin for the rasterization of the edges, clipped to the viewport
+			sf::IntRect region;
+			if (!sf::IntRect(lower - sf::Vector2i(1, 1), upper - lower + sf::Vector2i(3, 3)).intersects(antumbraTexture.getViewport(view), region))
+			{
+				return false;
+			}
+
+			for (const sf::IntRect& pending : mRegions)
+			{
+				if (pending.intersects(region))
+				{
+					flush(lightTexture, antumbraTexture, drawCalls);
+					break;
+				}
+			}
+			mRegions.push_back(region);
+
+			clearPixels(antumbraTexture, region, sf::Color::White);
+			antumbraTexture.setView(view);
+			drawCalls++;
+			return true;
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		/// \brief Multiply the pending antumbra regions on the light texture
+		/// \param lightTexture The light render texture
+		/// \param antumbraTexture The antumbra render texture
+		/// \param drawCalls The draw calls counter
+		//////////////////////////////////////////////////////////////////////////
+		void flush(sf::RenderTexture& lightTexture, sf::RenderTexture& antumbraTexture, unsigned int& drawCalls)
+		{
+			if (mRegions.empty())
+			{
+				return;
+			}
+
+			antumbraTexture.display();
+
+			mVertices.clear();
+			for (const sf::IntRect& region : mRegions)
+			{
+				sf::Vector2f lower(static_cast<float>(region.left), static_cast<float>(region.top));
+				sf::Vector2f upper(static_cast<float>(region.left + region.width), static_cast<float>(region.top + region.height));
+				sf::Vertex quad[4] = { sf::Vertex(lower, lower), sf::Vertex({ upper.x, lower.y }, { upper.x, lower.y }), sf::Vertex(upper, upper), sf::Vertex({ lower.x, upper.y }, { lower.x, upper.y }) };
+				appendQuad(mVertices, quad);
+			}
+
+			sf::View view = lightTexture.getView();
+			lightTexture.setView(lightTexture.getDefaultView());
+			lightTexture.draw(mVertices, sf::RenderStates(sf::BlendMultiply, sf::Transform::Identity, &antumbraTexture.getTexture(), nullptr));
+			lightTexture.setView(view);
+			drawCalls++;
+
+			mRegions.clear();
+		}
+
+	private:
+		std::vector<sf::IntRect> mRegions; ///< The pending antumbra regions, in pixels
+		sf::VertexArray mVertices; ///< The quads multiplying the regions back
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// \brief Add the points of penumbras
+/// \param points The points
+/// \param penumbras The penumbras
+/// \param shadowExtension The shadow extension
+//////////////////////////////////////////////////////////////////////////
+inline void appendPenumbraPoints(std::vector<sf::Vector2f>& points, const std::vector<Penumbra>& penumbras, float shadowExtension)
+{
+	for (const Penumbra& penumbra : penumbras)
+	{
+		points.push_back(penumbra._source);
+		points.push_back(penumbra._source + vectorNormalize(penumbra._lightEdge) * shadowExtension);
+		points.push_back(penumbra._source + vectorNormalize(penumbra._darkEdge) * shadowExtension);
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// \brief Base class for lights and light shape
 //////////////////////////////////////////////////////////////////////////
@@ -971,36 +1499,66 @@ class BaseLight
 		/// \param unshadowShader The unshadow shader
 		/// \param penumbras The penumbras
 		/// \param shadowExtension The shadow extension
+		/// \return The number of draw calls
 		//////////////////////////////////////////////////////////////////////////
-		void unmaskWithPenumbras(sf::RenderTexture& renderTexture, sf::BlendMode blendMode, sf::Shader& unshadowShader, const std::vector<Penumbra>& penumbras, float shadowExtension)
+		unsigned int unmaskWithPenumbras(sf::RenderTexture& renderTexture, sf::BlendMode blendMode, sf::Shader& unshadowShader, const std::vector<Penumbra>& penumbras, float shadowExtension)
 		{
+			unsigned int penumbrasCount = penumbras.size();
+			if (penumbrasCount == 0)
+			{
+				return 0;
+			}
+
+			// The brightnesses go in the vertex color (red : light, green : dark), so every penumbra is drawn at once
 			sf::VertexArray vertexArray;
 			vertexArray.setPrimitiveType(sf::PrimitiveType::Triangles);
-			vertexArray.resize(3);
+			vertexArray.resize(3 * penumbrasCount);
 
 			sf::RenderStates states;
 			states.blendMode = blendMode;
 			states.shader = &unshadowShader;
 
-			unsigned int penumbrasCount = penumbras.size();
 			for (unsigned int i = 0; i < penumbrasCount; i++)
 			{
-				unshadowShader.setUniform("lightBrightness", penumbras[i]._lightBrightness);
-				unshadowShader.setUniform("darkBrightness", penumbras[i]._darkBrightness);
-				vertexArray[0].position = penumbras[i]._source;
-				vertexArray[1].position = penumbras[i]._source + priv::vectorNormalize(penumbras[i]._lightEdge) * shadowExtension;
-				vertexArray[2].position = penumbras[i]._source + priv::vectorNormalize(penumbras[i]._darkEdge) * shadowExtension;
-				vertexArray[0].texCoords = sf::Vector2f(0.0f, 1.0f);
-				vertexArray[1].texCoords = sf::Vector2f(1.0f, 0.0f);
-				vertexArray[2].texCoords = sf::Vector2f(0.0f, 0.0f);
-				renderTexture.draw(vertexArray, states);
+				sf::Color brightness(static_cast<sf::Uint8>(penumbras[i]._lightBrightness * 255.0f + 0.5f), static_cast<sf::Uint8>(penumbras[i]._darkBrightness * 255.0f + 0.5f), 0);
+				vertexArray[3 * i + 0].position = penumbras[i]._source;
+				vertexArray[3 * i + 1].position = penumbras[i]._source + priv::vectorNormalize(penumbras[i]._lightEdge) * shadowExtension;
+				vertexArray[3 * i + 2].position = penumbras[i]._source + priv::vectorNormalize(penumbras[i]._darkEdge) * shadowExtension;
+				vertexArray[3 * i + 0].texCoords = sf::Vector2f(0.0f, 1.0f);
+				vertexArray[3 * i + 1].texCoords = sf::Vector2f(1.0f, 0.0f);
+				vertexArray[3 * i + 2].texCoords = sf::Vector2f(0.0f, 0.0f);
+				vertexArray[3 * i + 0].color = brightness;
+				vertexArray[3 * i + 1].color = brightness;
+				vertexArray[3 * i + 2].color = brightness;
 			}
+			renderTexture.draw(vertexArray, states);
+			return 1;
 		}
 
 	private:
 		bool mTurnedOn; ///< Is the light turned on ?
 };
 
+//////////////////////////////////////////////////////////////////////////
+/// \brief Get an order independent signature of shapes
+/// A shape entering, leaving, changing, being turned on or off or changing its render light over changes it
+/// \param shapes The shapes, of the given type
+/// \return The signature
+//////////////////////////////////////////////////////////////////////////
+template <typename Shape>
+std::size_t shapesSignature(const std::vector<QuadtreeOccupant*>& shapes)
+{
+	std::size_t signature = shapes.size();
+	for (const auto& occupant : shapes)
+	{
+		const Shape* shape = static_cast<const Shape*>(occupant);
+		std::size_t hash = std::hash<const void*>()(shape) * 31 + shape->getVersion();
+		hash = hash * 4 + (shape->renderLightOver() ? 2 : 0) + (shape->isTurnedOn() ? 1 : 0);
+		signature += hash * 2654435761u;
+	}
+	return signature;
+}
+
 } // namespace priv
 
 } // namespace ltbl
\ No newline at end of file
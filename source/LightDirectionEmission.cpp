@@ -10,6 +10,14 @@ LightDirectionEmission::LightDirectionEmission()
 	, mCastAngle(90.f)
 	, mSourceRadius(5.0f)
 	, mSourceDistance(100.0f)
+	, mSilhouettes()
+	, mRenderCount(0)
+	, mAntumbraPacker()
+	, mMaskVertices(sf::Triangles)
+	, mShadowTileSize(0.0f)
+	, mShadowTileAngleEpsilon(1.0f)
+	, mShadowTiles()
+	, mShadowTilePass(0)
 {
 }
 
@@ -23,61 +31,116 @@ const sf::Color& LightDirectionEmission::getColor() const
 	return mShape.getFillColor();
 }
 
-void LightDirectionEmission::render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, const std::vector<priv::QuadtreeOccupant*>& shapes, float shadowExtension)
+void LightDirectionEmission::render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, const std::vector<priv::QuadtreeOccupant*>& shapes, float shadowExtension, unsigned int convexSilhouetteThreshold, RenderStats& stats)
 {
     lightTempTexture.setView(view);
     lightTempTexture.clear(sf::Color::White);
 
-    // Mask off light shape (over-masking - mask too much, reveal penumbra/antumbra afterwards)
-	unsigned int shapesCount = shapes.size();
-	for (unsigned int i = 0; i < shapesCount; ++i)
+	mRenderCount++;
+
+    // Concave shapes cast their shadows through their convex parts
+    std::vector<LightShape*> casters;
+    casters.reserve(shapes.size());
+    for (const auto& occupant : shapes)
+    {
+        LightShape* pLightShape = static_cast<LightShape*>(occupant);
+        if (pLightShape != nullptr && pLightShape->isTurnedOn())
+        {
+            unsigned int partCount = pLightShape->getConvexPartCount();
+            if (partCount == 0)
+            {
+                casters.push_back(pLightShape);
+            }
+            for (unsigned int j = 0; j < partCount; j++)
+            {
+                casters.push_back(&pLightShape->getConvexPart(j));
+            }
+        }
+    }
+
+    // Shadows of different shapes only darken : their umbras and penumbras are multiplied all at once
+    std::vector<priv::Penumbra> penumbras;
+    float penumbrasExtension = 0.0f;
+
+	unsigned int castersCount = casters.size();
+	for (unsigned int i = 0; i < castersCount; ++i)
 	{
-        LightShape* pLightShape = static_cast<LightShape*>(shapes[i]);
-		if (pLightShape != nullptr && pLightShape->isTurnedOn())
+        LightShape* pLightShape = casters[i];
+
+		// Get boundaries
+		const Silhouette& silhouette = getSilhouette(*pLightShape, convexSilhouetteThreshold);
+		const std::vector<int>& innerBoundaryIndices = silhouette._innerBoundaryIndices;
+		const std::vector<sf::Vector2f>& innerBoundaryVectors = silhouette._innerBoundaryVectors;
+
+		if (innerBoundaryIndices.size() != 2 || silhouette._outerBoundaryIndices.size() != 2 || silhouette._umbraPenumbras.size() != 2)
 		{
-			// Get boundaries
-			std::vector<priv::Penumbra> penumbras;
-			std::vector<int> innerBoundaryIndices;
-			std::vector<int> outerBoundaryIndices;
-			std::vector<sf::Vector2f> innerBoundaryVectors;
-			std::vector<sf::Vector2f> outerBoundaryVectors;
+			continue;
+		}
 
-			getPenumbrasDirection(penumbras, innerBoundaryIndices, innerBoundaryVectors, outerBoundaryIndices, outerBoundaryVectors, *pLightShape);
+		float maxDist = 0.0f;
+		for (unsigned j = 0; j < pLightShape->getPointCount(); j++)
+		{
+			maxDist = std::max(maxDist, priv::vectorMagnitude(view.getCenter() - pLightShape->getTransform().transformPoint(pLightShape->getPoint(j))));
+		}
+		float totalShadowExtension = shadowExtension + maxDist;
 
-			if (innerBoundaryIndices.size() != 2 || outerBoundaryIndices.size() != 2)
-			{
-				continue;
-			}
+		// The umbra is bounded by the dark edges of the last penumbras of both sides
+		const priv::Penumbra& umbraA = silhouette._penumbras[silhouette._umbraPenumbras[0]];
+		const priv::Penumbra& umbraB = silhouette._penumbras[silhouette._umbraPenumbras[1]];
+		sf::Vector2f ua = umbraA._source + priv::vectorNormalize(umbraA._darkEdge) * totalShadowExtension;
+		sf::Vector2f ub = umbraB._source + priv::vectorNormalize(umbraB._darkEdge) * totalShadowExtension;
+		sf::Vector2f intersection;
+		bool antumbra = priv::rayIntersect(umbraA._source, umbraA._darkEdge, umbraB._source, umbraB._darkEdge, intersection) && priv::vectorMagnitude(intersection - umbraA._source) < totalShadowExtension;
 
-			antumbraTempTexture.clear(sf::Color::White);
-			antumbraTempTexture.setView(view);
+		if (!antumbra)
+		{
+			sf::Vertex quad[4] = { sf::Vertex(umbraA._source, sf::Color::Black), sf::Vertex(umbraB._source, sf::Color::Black), sf::Vertex(ub, sf::Color::Black), sf::Vertex(ua, sf::Color::Black) };
+			priv::appendQuad(mMaskVertices, quad);
+			penumbras.insert(penumbras.end(), silhouette._penumbras.begin(), silhouette._penumbras.end());
+			penumbrasExtension = std::max(penumbrasExtension, totalShadowExtension);
+			continue;
+		}
 
-			float maxDist = 0.0f;
-			for (unsigned j = 0; j < pLightShape->getPointCount(); j++)
-			{
-				maxDist = std::max(maxDist, priv::vectorMagnitude(view.getCenter() - pLightShape->getTransform().transformPoint(pLightShape->getPoint(j))));
-			}
-			float totalShadowExtension = shadowExtension + maxDist;
+		// A thin shape under a wide source : the umbra closes, the shape is masked alone (over-masking - mask too much, reveal penumbra/antumbra afterwards)
+		sf::Vector2f as = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[0]));
+		sf::Vector2f bs = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[1]));
+
+		sf::ConvexShape maskShape;
+		maskShape.setPointCount(4);
+		maskShape.setPoint(0, as);
+		maskShape.setPoint(1, bs);
+		maskShape.setPoint(2, bs + priv::vectorNormalize(innerBoundaryVectors[1]) * totalShadowExtension);
+		maskShape.setPoint(3, as + priv::vectorNormalize(innerBoundaryVectors[0]) * totalShadowExtension);
+		maskShape.setFillColor(sf::Color::Black);
+
+		// Only the region of the shadow is cleared and multiplied back, with the other antumbras packed in the texture
+		std::vector<sf::Vector2f> regionPoints = { maskShape.getPoint(0), maskShape.getPoint(1), maskShape.getPoint(2), maskShape.getPoint(3) };
+		priv::appendPenumbraPoints(regionPoints, silhouette._penumbras, totalShadowExtension);
+		if (!mAntumbraPacker.begin(lightTempTexture, antumbraTempTexture, view, regionPoints, stats._drawCalls))
+		{
+			continue;
+		}
 
-			sf::ConvexShape maskShape;
-			maskShape.setPointCount(4);
-			maskShape.setPoint(0, pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[0])));
-			maskShape.setPoint(1, pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[1])));
-			maskShape.setPoint(2, pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[1])) + priv::vectorNormalize(innerBoundaryVectors[1]) * totalShadowExtension);
-			maskShape.setPoint(3, pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[0])) + priv::vectorNormalize(innerBoundaryVectors[0]) * totalShadowExtension);
-			maskShape.setFillColor(sf::Color::Black);
-			antumbraTempTexture.draw(maskShape);
+		antumbraTempTexture.draw(maskShape);
+		stats._drawCalls++;
 
-			unmaskWithPenumbras(antumbraTempTexture, sf::BlendAdd, unshadowShader, penumbras, totalShadowExtension);
+		stats._drawCalls += unmaskWithPenumbras(antumbraTempTexture, sf::BlendAdd, unshadowShader, silhouette._penumbras, totalShadowExtension);
+    }
 
-			antumbraTempTexture.display();
+    mAntumbraPacker.flush(lightTempTexture, antumbraTempTexture, stats._drawCalls);
 
-			lightTempTexture.setView(lightTempTexture.getDefaultView());
-			lightTempTexture.draw(sf::Sprite(antumbraTempTexture.getTexture()), sf::BlendMultiply);
-			lightTempTexture.setView(view);
-		}
+    // Every umbra at once, then every penumbra at once
+    if (mMaskVertices.getVertexCount() > 0)
+    {
+        lightTempTexture.draw(mMaskVertices);
+        stats._batchedMasks += mMaskVertices.getVertexCount() / 6;
+        stats._maskBatches++;
+        mMaskVertices.clear();
+        stats._drawCalls++;
     }
+    stats._drawCalls += unmaskWithPenumbras(lightTempTexture, sf::BlendMultiply, unshadowShader, penumbras, penumbrasExtension);
 
+    unsigned int shapesCount = shapes.size();
     for (unsigned int i = 0; i < shapesCount; i++) 
 	{
         LightShape* pLightShape = static_cast<LightShape*>(shapes[i]);
@@ -86,14 +149,18 @@ void LightDirectionEmission::render(const sf::View& view, sf::RenderTexture& lig
             pLightShape->setColor(sf::Color::White);
 
             lightTempTexture.draw(*pLightShape);
+            stats._drawCalls += std::max(1u, pLightShape->getConvexPartCount());
         }
     }
 
     lightTempTexture.setView(lightTempTexture.getDefaultView());
 	mShape.setSize(lightTempTexture.getView().getSize());
     lightTempTexture.draw(mShape, sf::BlendMultiply);
+	stats._drawCalls++;
 
     lightTempTexture.display();
+
+	releaseSilhouettes();
 }
 
 void LightDirectionEmission::setCastDirection(const sf::Vector2f& castDirection)
@@ -140,71 +207,206 @@ float LightDirectionEmission::getSourceDistance() const
 	return mSourceDistance;
 }
 
-void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape)
+void LightDirectionEmission::setShadowTileSize(float size)
 {
-	const int numPoints = shape.getPointCount();
+	if (size != mShadowTileSize)
+	{
+		mShadowTileSize = std::max(size, 0.0f);
+		mShadowTiles.clear();
+	}
+}
 
-	innerBoundaryIndices.reserve(2);
-	innerBoundaryVectors.reserve(2);
-	penumbras.reserve(2);
+float LightDirectionEmission::getShadowTileSize() const
+{
+	return mShadowTileSize;
+}
 
-	std::vector<bool> bothEdgesBoundaryWindings;
-	bothEdgesBoundaryWindings.reserve(2);
+void LightDirectionEmission::setShadowTileAngleEpsilon(float epsilon)
+{
+	mShadowTileAngleEpsilon = epsilon;
+}
 
-	// Calculate front and back facing sides
-	std::vector<bool> facingFrontBothEdges;
-	facingFrontBothEdges.reserve(numPoints);
+float LightDirectionEmission::getShadowTileAngleEpsilon() const
+{
+	return mShadowTileAngleEpsilon;
+}
 
-	std::vector<bool> facingFrontOneEdge;
-	facingFrontOneEdge.reserve(numPoints);
+bool LightDirectionEmission::updateShadowTile(const sf::Vector2i& tile, const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int pixels)
+{
+	std::size_t signature = priv::shapesSignature<LightShape>(shapes);
 
-	for (int i = 0; i < numPoints; i++) 
-	{
-		sf::Vector2f point = shape.getTransform().transformPoint(shape.getPoint(i));
-		sf::Vector2f nextPoint = shape.getTransform().transformPoint(shape.getPoint((i < numPoints - 1) ? i + 1 : 0));
-		sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -mCastDirection.y, mCastDirection.x }) * mSourceRadius;
-		sf::Vector2f firstEdgeRay = point - (point - mCastDirection * mSourceDistance - perpendicularOffset);
-		sf::Vector2f secondEdgeRay = point - (point - mCastDirection * mSourceDistance + perpendicularOffset);
-		sf::Vector2f firstNextEdgeRay = nextPoint - (point - mCastDirection * mSourceDistance - perpendicularOffset);
-		sf::Vector2f secondNextEdgeRay = nextPoint - (point - mCastDirection * mSourceDistance + perpendicularOffset);
-		sf::Vector2f pointToNextPoint = nextPoint - point;
-		sf::Vector2f normal = priv::vectorNormalize(sf::Vector2f(-pointToNextPoint.y, pointToNextPoint.x));
-
-		// Front facing, mark it
-		facingFrontBothEdges.push_back((priv::vectorDot(firstEdgeRay, normal) > 0.0f && priv::vectorDot(secondEdgeRay, normal) > 0.0f) || (priv::vectorDot(firstNextEdgeRay, normal) > 0.0f && priv::vectorDot(secondNextEdgeRay, normal) > 0.0f));
-		facingFrontOneEdge.push_back((priv::vectorDot(firstEdgeRay, normal) > 0.0f || priv::vectorDot(secondEdgeRay, normal) > 0.0f) || priv::vectorDot(firstNextEdgeRay, normal) > 0.0f || priv::vectorDot(secondNextEdgeRay, normal) > 0.0f);
-	}
+	ShadowTile& shadowTile = mShadowTiles[std::make_pair(tile.x, tile.y)];
+	shadowTile._lastUse = mShadowTilePass;
 
-	// Go through front/back facing list. Where the facing direction switches, there is a boundary
-	for (int i = 1; i < numPoints; i++)
+	// The angle wraps around
+	float angleDelta = std::fmod(std::abs(mCastAngle - shadowTile._castAngle), 360.0f);
+	angleDelta = std::min(angleDelta, 360.0f - angleDelta);
+
+	bool changed = shadowTile._texture == nullptr || shadowTile._texture->getSize() != sf::Vector2u(pixels, pixels) || angleDelta > mShadowTileAngleEpsilon
+		|| shadowTile._sourceRadius != mSourceRadius || shadowTile._sourceDistance != mSourceDistance || shadowTile._color != getColor() || shadowTile._signature != signature;
+	if (changed)
 	{
-		if (facingFrontBothEdges[i] != facingFrontBothEdges[i - 1]) 
+		if (shadowTile._texture == nullptr)
 		{
-			innerBoundaryIndices.push_back(i);
-			bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[i]);
+			shadowTile._texture.reset(new sf::RenderTexture());
 		}
+		if (shadowTile._texture->getSize() != sf::Vector2u(pixels, pixels))
+		{
+			shadowTile._texture->create(pixels, pixels);
+			shadowTile._texture->setSmooth(true);
+		}
+		shadowTile._castAngle = mCastAngle;
+		shadowTile._sourceRadius = mSourceRadius;
+		shadowTile._sourceDistance = mSourceDistance;
+		shadowTile._color = getColor();
+		shadowTile._signature = signature;
 	}
+	return changed;
+}
+
+sf::RenderTexture& LightDirectionEmission::getShadowTileTexture(const sf::Vector2i& tile)
+{
+	return *mShadowTiles[std::make_pair(tile.x, tile.y)]._texture;
+}
 
-	// Check looping indices separately
-	if (facingFrontBothEdges[0] != facingFrontBothEdges[numPoints - 1]) 
+void LightDirectionEmission::releaseShadowTiles()
+{
+	// Tiles out of view are kept for a few seconds, to pan back without rendering them again
+	const unsigned int maxAge = 300;
+	for (auto itr = mShadowTiles.begin(); itr != mShadowTiles.end();)
 	{
-		innerBoundaryIndices.push_back(0);
-		bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[0]);
+		if (mShadowTilePass - itr->second._lastUse > maxAge)
+		{
+			itr = mShadowTiles.erase(itr);
+		}
+		else
+		{
+			itr++;
+		}
 	}
+	mShadowTilePass++;
+}
 
-	// Go through front/back facing list. Where the facing direction switches, there is a boundary
-	for (int i = 1; i < numPoints; i++)
+void LightDirectionEmission::releaseSilhouettes()
+{
+	// Removed shapes and rebuilt convex parts are never queried again, their silhouettes are released after a while
+	const unsigned int maxAge = 60;
+	for (auto itr = mSilhouettes.begin(); itr != mSilhouettes.end();)
 	{
-		if (facingFrontOneEdge[i] != facingFrontOneEdge[i - 1])
+		if (mRenderCount - itr->second._lastUse > maxAge)
 		{
-			outerBoundaryIndices.push_back(i);
+			itr = mSilhouettes.erase(itr);
+		}
+		else
+		{
+			itr++;
 		}
 	}
+}
+
+const LightDirectionEmission::Silhouette& LightDirectionEmission::getSilhouette(const LightShape& shape, unsigned int convexSilhouetteThreshold)
+{
+	Silhouette& silhouette = mSilhouettes[&shape];
+	silhouette._lastUse = mRenderCount;
+
+	if (silhouette._shapeVersion != shape.getVersion() || silhouette._castDirection != mCastDirection || silhouette._sourceRadius != mSourceRadius || silhouette._sourceDistance != mSourceDistance)
+	{
+		silhouette._penumbras.clear();
+		silhouette._innerBoundaryIndices.clear();
+		silhouette._innerBoundaryVectors.clear();
+		silhouette._outerBoundaryIndices.clear();
+		silhouette._outerBoundaryVectors.clear();
+		silhouette._umbraPenumbras.clear();
+		getPenumbrasDirection(silhouette._penumbras, silhouette._innerBoundaryIndices, silhouette._innerBoundaryVectors, silhouette._outerBoundaryIndices, silhouette._outerBoundaryVectors, silhouette._umbraPenumbras, shape, convexSilhouetteThreshold);
+
+		silhouette._castDirection = mCastDirection;
+		silhouette._sourceRadius = mSourceRadius;
+		silhouette._sourceDistance = mSourceDistance;
+		silhouette._shapeVersion = shape.getVersion();
+	}
+
+	return silhouette;
+}
+
+void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, std::vector<unsigned int>& umbraPenumbras, const LightShape& shape, unsigned int convexSilhouetteThreshold)
+{
+	const int numPoints = shape.getPointCount();
+
+	innerBoundaryIndices.reserve(2);
+	innerBoundaryVectors.reserve(2);
+	penumbras.reserve(2);
+
+	std::vector<bool> bothEdgesBoundaryWindings;
+	bothEdgesBoundaryWindings.reserve(2);
 
-	// Check looping indices separately
-	if (facingFrontOneEdge[0] != facingFrontOneEdge[numPoints - 1])
+	// The points are transformed when needed, so the search of large convex shapes stays logarithmic
+	const sf::Transform& transform = shape.getTransform();
+	auto worldPoint = [&transform, &shape](int index)
 	{
-		outerBoundaryIndices.push_back(0);
+		return transform.transformPoint(shape.getPoint(index));
+	};
+
+	// The light comes from the same direction for every point, so the rays from both edges of the source are shared
+	sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -mCastDirection.y, mCastDirection.x }) * mSourceRadius;
+	sf::Vector2f leftEdgeRay = mCastDirection * mSourceDistance + perpendicularOffset;
+	sf::Vector2f rightEdgeRay = mCastDirection * mSourceDistance - perpendicularOffset;
+
+	// Large convex shapes : search the boundaries around the extreme points instead of walking every side
+	bool boundariesFound = numPoints >= static_cast<int>(convexSilhouetteThreshold) && getConvexBoundaries(innerBoundaryIndices, bothEdgesBoundaryWindings, outerBoundaryIndices, leftEdgeRay, rightEdgeRay, shape);
+
+	if (!boundariesFound)
+	{
+		innerBoundaryIndices.clear();
+		bothEdgesBoundaryWindings.clear();
+		outerBoundaryIndices.clear();
+
+		// Calculate front and back facing sides
+		std::vector<bool> facingFrontBothEdges;
+		facingFrontBothEdges.reserve(numPoints);
+
+		std::vector<bool> facingFrontOneEdge;
+		facingFrontOneEdge.reserve(numPoints);
+
+		for (int i = 0; i < numPoints; i++) 
+		{
+			bool bothEdges;
+			bool oneEdge;
+			getFacing(bothEdges, oneEdge, worldPoint((i < numPoints - 1) ? i + 1 : 0) - worldPoint(i), leftEdgeRay, rightEdgeRay);
+			facingFrontBothEdges.push_back(bothEdges);
+			facingFrontOneEdge.push_back(oneEdge);
+		}
+
+		// Go through front/back facing list. Where the facing direction switches, there is a boundary
+		for (int i = 1; i < numPoints; i++)
+		{
+			if (facingFrontBothEdges[i] != facingFrontBothEdges[i - 1]) 
+			{
+				innerBoundaryIndices.push_back(i);
+				bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[i]);
+			}
+		}
+
+		// Check looping indices separately
+		if (facingFrontBothEdges[0] != facingFrontBothEdges[numPoints - 1]) 
+		{
+			innerBoundaryIndices.push_back(0);
+			bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[0]);
+		}
+
+		// Go through front/back facing list. Where the facing direction switches, there is a boundary
+		for (int i = 1; i < numPoints; i++)
+		{
+			if (facingFrontOneEdge[i] != facingFrontOneEdge[i - 1])
+			{
+				outerBoundaryIndices.push_back(i);
+			}
+		}
+
+		// Check looping indices separately
+		if (facingFrontOneEdge[0] != facingFrontOneEdge[numPoints - 1])
+		{
+			outerBoundaryIndices.push_back(0);
+		}
 	}
 
 	for (unsigned bi = 0; bi < innerBoundaryIndices.size(); bi++) 
@@ -212,10 +414,9 @@ void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>&
 		int penumbraIndex = innerBoundaryIndices[bi];
 		bool winding = bothEdgesBoundaryWindings[bi];
 
-		sf::Vector2f point = shape.getTransform().transformPoint(shape.getPoint(penumbraIndex));
-		sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -mCastDirection.y, mCastDirection.x }) * mSourceRadius;
-		sf::Vector2f firstEdgeRay = point - (point - mCastDirection * mSourceDistance + perpendicularOffset);
-		sf::Vector2f secondEdgeRay = point - (point - mCastDirection * mSourceDistance - perpendicularOffset);
+		sf::Vector2f point = worldPoint(penumbraIndex);
+		sf::Vector2f firstEdgeRay = rightEdgeRay;
+		sf::Vector2f secondEdgeRay = leftEdgeRay;
 
 		// Add boundary vector
 		innerBoundaryVectors.push_back(winding ? secondEdgeRay : firstEdgeRay);
@@ -231,36 +432,11 @@ void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>&
 
 		while (penumbraIndex != -1) 
 		{
-			sf::Vector2f nextPoint;
-			int nextPointIndex;
-
-			if (penumbraIndex < numPoints - 1) 
-			{
-				nextPointIndex = penumbraIndex + 1;
-				nextPoint = shape.getTransform().transformPoint(shape.getPoint(penumbraIndex + 1));
-			}
-			else 
-			{
-				nextPointIndex = 0;
-				nextPoint = shape.getTransform().transformPoint(shape.getPoint(0));
-			}
-
-			sf::Vector2f pointToNextPoint = nextPoint - point;
-
-			sf::Vector2f prevPoint;
-			int prevPointIndex;
-
-			if (penumbraIndex > 0) 
-			{
-				prevPointIndex = penumbraIndex - 1;
-				prevPoint = shape.getTransform().transformPoint(shape.getPoint(penumbraIndex - 1));
-			}
-			else 
-			{
-				prevPointIndex = numPoints - 1;
-				prevPoint = shape.getTransform().transformPoint(shape.getPoint(numPoints - 1));
-			}
+			int nextPointIndex = (penumbraIndex < numPoints - 1) ? penumbraIndex + 1 : 0;
+			sf::Vector2f pointToNextPoint = worldPoint(nextPointIndex) - point;
 
+			int prevPointIndex = (penumbraIndex > 0) ? penumbraIndex - 1 : numPoints - 1;
+			sf::Vector2f prevPoint = worldPoint(prevPointIndex);
 			sf::Vector2f pointToPrevPoint = prevPoint - point;
 
 			priv::Penumbra penumbra;
@@ -293,10 +469,7 @@ void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>&
 
 					hasPrevPenumbra = true;
 					prevPenumbraLightEdgeVector = penumbra._darkEdge;
-					point = shape.getTransform().transformPoint(shape.getPoint(penumbraIndex));
-					perpendicularOffset = priv::vectorNormalize({ -mCastDirection.y, mCastDirection.x }) * mSourceRadius;
-					firstEdgeRay = point - (point - mCastDirection * mSourceDistance + perpendicularOffset);
-					secondEdgeRay = point - (point - mCastDirection * mSourceDistance - perpendicularOffset);
+					point = worldPoint(penumbraIndex);
 					outerBoundaryVector = secondEdgeRay;
 				}
 				else 
@@ -338,10 +511,7 @@ void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>&
 
 					hasPrevPenumbra = true;
 					prevPenumbraLightEdgeVector = penumbra._darkEdge;
-					point = shape.getTransform().transformPoint(shape.getPoint(penumbraIndex));
-					perpendicularOffset = priv::vectorNormalize({ -mCastDirection.y, mCastDirection.x }) * mSourceRadius;
-					firstEdgeRay = point - (point - mCastDirection * mSourceDistance + perpendicularOffset);
-					secondEdgeRay = point - (point - mCastDirection * mSourceDistance - perpendicularOffset);
+					point = worldPoint(penumbraIndex);
 					outerBoundaryVector = firstEdgeRay;
 				}
 				else 
@@ -359,7 +529,97 @@ void LightDirectionEmission::getPenumbrasDirection(std::vector<priv::Penumbra>&
 
 			penumbras.push_back(penumbra);
 		}
+
+		umbraPenumbras.push_back(penumbras.size() - 1);
+	}
+}
+
+void LightDirectionEmission::getFacing(bool& facingFrontBothEdges, bool& facingFrontOneEdge, const sf::Vector2f& pointToNextPoint, const sf::Vector2f& leftEdgeRay, const sf::Vector2f& rightEdgeRay) const
+{
+	sf::Vector2f firstEdgeRay = leftEdgeRay;
+	sf::Vector2f secondEdgeRay = rightEdgeRay;
+	sf::Vector2f firstNextEdgeRay = pointToNextPoint + leftEdgeRay;
+	sf::Vector2f secondNextEdgeRay = pointToNextPoint + rightEdgeRay;
+	sf::Vector2f normal = priv::vectorNormalize(sf::Vector2f(-pointToNextPoint.y, pointToNextPoint.x));
+
+	// Front facing, mark it
+	facingFrontBothEdges = (priv::vectorDot(firstEdgeRay, normal) > 0.0f && priv::vectorDot(secondEdgeRay, normal) > 0.0f) || (priv::vectorDot(firstNextEdgeRay, normal) > 0.0f && priv::vectorDot(secondNextEdgeRay, normal) > 0.0f);
+	facingFrontOneEdge = (priv::vectorDot(firstEdgeRay, normal) > 0.0f || priv::vectorDot(secondEdgeRay, normal) > 0.0f) || priv::vectorDot(firstNextEdgeRay, normal) > 0.0f || priv::vectorDot(secondNextEdgeRay, normal) > 0.0f;
+}
+
+bool LightDirectionEmission::getConvexBoundaries(std::vector<int>& innerBoundaryIndices, std::vector<bool>& bothEdgesBoundaryWindings, std::vector<int>& outerBoundaryIndices, const sf::Vector2f& leftEdgeRay, const sf::Vector2f& rightEdgeRay, const LightShape& shape) const
+{
+	// The silhouette of a convex shape lit from a direction is at its extreme points across that direction
+	int extremes[2];
+	if (!shape.getExtremes({ -mCastDirection.y, mCastDirection.x }, extremes[0], extremes[1]))
+	{
+		return false;
 	}
+
+	const int numPoints = static_cast<int>(shape.getPointCount());
+	const sf::Transform& transform = shape.getTransform();
+	auto worldPoint = [&transform, &shape](int index)
+	{
+		return transform.transformPoint(shape.getPoint(index));
+	};
+
+	// The facing direction of a convex shape switches only twice, near the extreme points
+	for (int edges = 0; edges < 2; edges++)
+	{
+		bool bothEdges = (edges == 0);
+		int boundaries[2];
+		bool windings[2];
+		for (int e = 0; e < 2; e++)
+		{
+			boundaries[e] = -1;
+			for (int step = 0; step <= numPoints / 2 && boundaries[e] < 0; step++)
+			{
+				for (int side = 0; side < 2 && boundaries[e] < 0; side++)
+				{
+					int index = ((extremes[e] + ((side == 0) ? step : -step)) % numPoints + numPoints) % numPoints;
+					int prevIndex = (index > 0) ? index - 1 : numPoints - 1;
+					int nextIndex = (index < numPoints - 1) ? index + 1 : 0;
+					bool facingBoth, facingOne, prevFacingBoth, prevFacingOne;
+					sf::Vector2f point = worldPoint(index);
+					getFacing(facingBoth, facingOne, worldPoint(nextIndex) - point, leftEdgeRay, rightEdgeRay);
+					getFacing(prevFacingBoth, prevFacingOne, point - worldPoint(prevIndex), leftEdgeRay, rightEdgeRay);
+					bool facing = (bothEdges) ? facingBoth : facingOne;
+					if (facing != ((bothEdges) ? prevFacingBoth : prevFacingOne))
+					{
+						boundaries[e] = index;
+						windings[e] = facing;
+					}
+				}
+			}
+			if (boundaries[e] < 0)
+			{
+				return false;
+			}
+		}
+		if (boundaries[0] == boundaries[1])
+		{
+			return false;
+		}
+
+		// Same order as the linear walk : increasing indices, 0 last
+		int first = (boundaries[0] == 0) ? numPoints : boundaries[0];
+		int second = (boundaries[1] == 0) ? numPoints : boundaries[1];
+		int order = (first < second) ? 0 : 1;
+		if (bothEdges)
+		{
+			innerBoundaryIndices.push_back(boundaries[order]);
+			innerBoundaryIndices.push_back(boundaries[1 - order]);
+			bothEdgesBoundaryWindings.push_back(windings[order]);
+			bothEdgesBoundaryWindings.push_back(windings[1 - order]);
+		}
+		else
+		{
+			outerBoundaryIndices.push_back(boundaries[order]);
+			outerBoundaryIndices.push_back(boundaries[1 - order]);
+		}
+	}
+
+	return true;
 }
 
-} // namespace ltbl
\ No newline at end of file
+} // namespace ltbl
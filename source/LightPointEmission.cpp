@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
+
 #include "LightPointEmission.hpp"
 
 namespace ltbl
@@ -9,6 +13,20 @@ LightPointEmission::LightPointEmission()
 	, mLocalCastCenter()
 	, mSourceRadius(8.0f)
 	, mShadowOverExtendMultiplier(1.4f)
+	, mRadius(0.0f)
+	, mMaskVertices(sf::Triangles)
+	, mAntumbraPacker()
+	, mShadows()
+	, mShadowsPass(0)
+	, mShadowsSoft(false)
+	, mCastShadows(true)
+	, mStatic(false)
+	, mCacheDirty(true)
+	, mCacheVersion(0)
+	, mCacheSignature(0)
+	, mCacheRenderFrame(0)
+	, mCacheUseFrame(0)
+	, mCacheTexture()
 {
 }
 
@@ -37,6 +55,7 @@ const sf::IntRect& LightPointEmission::getTextureRect() const
 void LightPointEmission::setColor(const sf::Color& color)
 {
 	mSprite.setColor(color);
+	mCacheDirty = true;
 }
 
 const sf::Color& LightPointEmission::getColor() const
@@ -141,26 +160,16 @@ const sf::Vector2f& LightPointEmission::getOrigin() const
 	return mSprite.getOrigin();
 }
 
-void LightPointEmission::render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, sf::Shader& lightOverShapeShader, const std::vector<priv::QuadtreeOccupant*>& shapes, bool normalsEnabled, sf::Shader& normalsShader)
+void LightPointEmission::render(const sf::View& view, sf::RenderTexture& lightTempTexture, sf::RenderTexture& antumbraTempTexture, sf::Shader& unshadowShader, sf::Shader& lightOverShapeShader, const std::vector<priv::QuadtreeOccupant*>& shapes, bool normalsEnabled, sf::Shader& normalsShader, unsigned int convexSilhouetteThreshold, unsigned int pass, priv::ShadowLod lod, RenderStats& stats)
 {
     float shadowExtension = mShadowOverExtendMultiplier * (getAABB().width + getAABB().height);
 
-    struct OuterEdges 
-	{
-        std::vector<int> _outerBoundaryIndices;
-        std::vector<sf::Vector2f> _outerBoundaryVectors;
-    };
-
-    std::vector<OuterEdges> outerEdges(shapes.size());
-
-    std::vector<int> innerBoundaryIndices;
-    std::vector<sf::Vector2f> innerBoundaryVectors;
-    std::vector<priv::Penumbra> penumbras;
-
     //----- Emission
 
-    lightTempTexture.clear();
+    // Only the pixels of the view are cleared, the light system restricts it to the footprint of the light
+    priv::clearPixels(lightTempTexture, lightTempTexture.getViewport(view), sf::Color::Black);
     lightTempTexture.setView(view);
+    stats._drawCalls++;
 
 	if (normalsEnabled) 
 	{
@@ -183,106 +192,109 @@ void LightPointEmission::render(const sf::View& view, sf::RenderTexture& lightTe
 	{
 		lightTempTexture.draw(mSprite);
 	}
+	stats._drawCalls++;
+
+    if (lod == priv::ShadowLod::None)
+    {
+        lightTempTexture.display();
+        return;
+    }
+
+    // The shadows are computed once per pass, then rasterized for each view
+    updateShadows(shapes, convexSilhouetteThreshold, pass, lod == priv::ShadowLod::Soft, stats);
+    sf::Vector2f castCenter = getCastCenter();
 
     //----- Shapes
 
+    // Visible part of the light : view bounds (rotation included) intersected with the light bounds
+    sf::FloatRect visibleBounds;
+    if (!view.getInverseTransform().transformRect(sf::FloatRect(-1.0f, -1.0f, 2.0f, 2.0f)).intersects(getAABB(), visibleBounds))
+    {
+        visibleBounds = sf::FloatRect();
+    }
+
+    // Shadows of different shapes only darken : their umbras and penumbras are multiplied all at once
+    std::vector<priv::Penumbra> penumbras;
+
     // Mask off light shape (over-masking - mask too much, reveal penumbra/antumbra afterwards)
-    unsigned int shapesCount = shapes.size();
-    for (unsigned int i = 0; i < shapesCount; ++i) 
+    for (const Shadow& shadow : mShadows)
 	{
-        LightShape* pLightShape = static_cast<LightShape*>(shapes[i]);
-		if (pLightShape->isAwake() && pLightShape->isTurnedOn())
+		const sf::Vector2f& as = shadow._outerStart;
+		const sf::Vector2f& bs = shadow._outerEnd;
+		const sf::Vector2f& ad = shadow._outerStartVector;
+		const sf::Vector2f& bd = shadow._outerEndVector;
+
+		// Skip the shape if neither its body nor its shadow quad reach the visible part of the light
+		if (!shadow._shape->getAABB().intersects(visibleBounds) && !priv::hullIntersectsRect({ as, bs, bs + priv::vectorNormalize(bd) * shadowExtension, as + priv::vectorNormalize(ad) * shadowExtension }, visibleBounds))
 		{
-			// Get boundaries
-			innerBoundaryIndices.clear();
-			innerBoundaryVectors.clear();
-			penumbras.clear();
-			getPenumbrasPoint(penumbras, innerBoundaryIndices, innerBoundaryVectors, outerEdges[i]._outerBoundaryIndices, outerEdges[i]._outerBoundaryVectors, *pLightShape);
+			stats._offscreenShapes++;
+			continue;
+		}
 
-			if (innerBoundaryIndices.size() != 2 || outerEdges[i]._outerBoundaryIndices.size() != 2)
+		// Hard shadows : the shadow quad of a point source at the cast center
+		if (lod == priv::ShadowLod::Hard)
+		{
+			sf::Vertex quad[4] = { sf::Vertex(as, sf::Color::Black), sf::Vertex(bs, sf::Color::Black), sf::Vertex(bs + priv::vectorNormalize(bs - castCenter) * shadowExtension, sf::Color::Black), sf::Vertex(as + priv::vectorNormalize(as - castCenter) * shadowExtension, sf::Color::Black) };
+			priv::appendQuad(mMaskVertices, quad);
+			continue;
+		}
+
+		// Handle antumbras as a seperate case
+		if (shadow._antumbra)
+		{
+			// Only the region of the shadow is cleared and multiplied back, with the other antumbras packed in the texture
+			if (!mAntumbraPacker.begin(lightTempTexture, antumbraTempTexture, view, shadow._regionPoints, stats._drawCalls))
 			{
 				continue;
 			}
 
-			// Render shape
-			if (!pLightShape->renderLightOver())
+			sf::ConvexShape maskShape;
+			maskShape.setPointCount(shadow._maskPoints.size());
+			for (unsigned int j = 0; j < shadow._maskPoints.size(); j++)
 			{
-				pLightShape->setColor(sf::Color::Black);
-				lightTempTexture.draw(*pLightShape);
+				maskShape.setPoint(j, shadow._maskPoints[j]);
 			}
+			maskShape.setFillColor(sf::Color::Black);
+			antumbraTempTexture.draw(maskShape);
+			stats._drawCalls++;
 
-			sf::Vector2f as = pLightShape->getTransform().transformPoint(pLightShape->getPoint(outerEdges[i]._outerBoundaryIndices[0]));
-			sf::Vector2f bs = pLightShape->getTransform().transformPoint(pLightShape->getPoint(outerEdges[i]._outerBoundaryIndices[1]));
-			sf::Vector2f ad = outerEdges[i]._outerBoundaryVectors[0];
-			sf::Vector2f bd = outerEdges[i]._outerBoundaryVectors[1];
-
-			sf::Vector2f intersectionOuter;
-
-			// Handle antumbras as a seperate case
-			if (priv::rayIntersect(as, ad, bs, bd, intersectionOuter))
-			{
-				sf::Vector2f asi = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[0]));
-				sf::Vector2f bsi = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[1]));
-				sf::Vector2f adi = innerBoundaryVectors[0];
-				sf::Vector2f bdi = innerBoundaryVectors[1];
-
-				antumbraTempTexture.clear(sf::Color::White);
-				antumbraTempTexture.setView(view);
-
-				sf::Vector2f intersectionInner;
-
-				if (priv::rayIntersect(asi, adi, bsi, bdi, intersectionInner))
-				{
-					sf::ConvexShape maskShape;
-					maskShape.setPointCount(3);
-					maskShape.setPoint(0, asi);
-					maskShape.setPoint(1, bsi);
-					maskShape.setPoint(2, intersectionInner);
-					maskShape.setFillColor(sf::Color::Black);
-					antumbraTempTexture.draw(maskShape);
-				}
-				else
-				{
-					sf::ConvexShape maskShape;
-					maskShape.setPointCount(4);
-					maskShape.setPoint(0, asi);
-					maskShape.setPoint(1, bsi);
-					maskShape.setPoint(2, bsi + priv::vectorNormalize(bdi) * shadowExtension);
-					maskShape.setPoint(3, asi + priv::vectorNormalize(adi) * shadowExtension);
-					maskShape.setFillColor(sf::Color::Black);
-					antumbraTempTexture.draw(maskShape);
-				}
+			stats._drawCalls += unmaskWithPenumbras(antumbraTempTexture, sf::BlendAdd, unshadowShader, shadow._penumbras, shadowExtension);
+		}
+		else
+		{
+			// Batched : masks and penumbras only darken, so the order they are drawn in does not matter
+			sf::Vertex quad[4] = { sf::Vertex(as, sf::Color::Black), sf::Vertex(bs, sf::Color::Black), sf::Vertex(bs + priv::vectorNormalize(bd) * shadowExtension, sf::Color::Black), sf::Vertex(as + priv::vectorNormalize(ad) * shadowExtension, sf::Color::Black) };
+			priv::appendQuad(mMaskVertices, quad);
 
-				unmaskWithPenumbras(antumbraTempTexture, sf::BlendAdd, unshadowShader, penumbras, shadowExtension);
+			penumbras.insert(penumbras.end(), shadow._penumbras.begin(), shadow._penumbras.end());
+		}
+    }
 
-				antumbraTempTexture.display();
+    mAntumbraPacker.flush(lightTempTexture, antumbraTempTexture, stats._drawCalls);
 
-				lightTempTexture.setView(lightTempTexture.getDefaultView());
-				lightTempTexture.draw(sf::Sprite(antumbraTempTexture.getTexture()), sf::BlendMultiply);
-				lightTempTexture.setView(view);
-			}
-			else
-			{
-				sf::ConvexShape maskShape;
-				maskShape.setPointCount(4);
-				maskShape.setPoint(0, as);
-				maskShape.setPoint(1, bs);
-				maskShape.setPoint(2, bs + priv::vectorNormalize(bd) * shadowExtension);
-				maskShape.setPoint(3, as + priv::vectorNormalize(ad) * shadowExtension);
-				maskShape.setFillColor(sf::Color::Black);
-				lightTempTexture.draw(maskShape);
-
-				unmaskWithPenumbras(lightTempTexture, sf::BlendMultiply, unshadowShader, penumbras, shadowExtension);
-			}
-		}
+    // Every umbra of the light at once, then every penumbra at once
+    if (mMaskVertices.getVertexCount() > 0)
+    {
+        lightTempTexture.draw(mMaskVertices);
+        stats._batchedMasks += mMaskVertices.getVertexCount() / 6;
+        stats._maskBatches++;
+        mMaskVertices.clear();
+        stats._drawCalls++;
     }
+    stats._drawCalls += unmaskWithPenumbras(lightTempTexture, sf::BlendMultiply, unshadowShader, penumbras, shadowExtension);
 
+    unsigned int shapesCount = shapes.size();
     for (unsigned i = 0; i < shapesCount; i++) 
 	{
         LightShape* pLightShape = static_cast<LightShape*>(shapes[i]);
 
         if (pLightShape->renderLightOver()) 
 		{
+            // The light over shapes is only rendered with soft shadows
+            if (lod != priv::ShadowLod::Soft)
+            {
+                continue;
+            }
             pLightShape->setColor(sf::Color::White);
             lightTempTexture.draw(*pLightShape, &lightOverShapeShader);
         }
@@ -291,14 +303,138 @@ void LightPointEmission::render(const sf::View& view, sf::RenderTexture& lightTe
             pLightShape->setColor(sf::Color::Black);
             lightTempTexture.draw(*pLightShape);
         }
+        stats._drawCalls += std::max(1u, pLightShape->getConvexPartCount());
     }
 
     lightTempTexture.display();
 }
 
+void LightPointEmission::updateShadows(const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int convexSilhouetteThreshold, unsigned int pass, bool soft, RenderStats& stats)
+{
+	// Soft shadows also serve hard shadows, hard ones are computed again if a view of the pass needs soft ones
+	if (pass == mShadowsPass && (mShadowsSoft || !soft))
+	{
+		return;
+	}
+	mShadowsPass = pass;
+	mShadowsSoft = soft;
+	mShadows.clear();
+
+    float shadowExtension = mShadowOverExtendMultiplier * (getAABB().width + getAABB().height);
+
+    struct OuterEdges 
+	{
+        std::vector<int> _outerBoundaryIndices;
+        std::vector<sf::Vector2f> _outerBoundaryVectors;
+    };
+
+    // Concave shapes cast their shadows through their convex parts, the ones out of the radius are culled
+    sf::Vector2f castCenter = getCastCenter();
+    std::vector<LightShape*> casters;
+    casters.reserve(shapes.size());
+    for (const auto& occupant : shapes)
+    {
+        LightShape* pLightShape = static_cast<LightShape*>(occupant);
+        if (pLightShape->isAwake() && pLightShape->isTurnedOn())
+        {
+            unsigned int partCount = pLightShape->getConvexPartCount();
+            if (partCount == 0 && (mRadius <= 0.0f || isInRadius(*pLightShape, castCenter)))
+            {
+                casters.push_back(pLightShape);
+            }
+            else if (partCount == 0)
+            {
+                stats._culledShapes++;
+            }
+            for (unsigned int j = 0; j < partCount; j++)
+            {
+                if (mRadius <= 0.0f || isInRadius(pLightShape->getConvexPart(j), castCenter))
+                {
+                    casters.push_back(&pLightShape->getConvexPart(j));
+                }
+                else
+                {
+                    stats._culledShapes++;
+                }
+            }
+        }
+    }
+
+    // Shapes fully in the umbra of nearer shapes cast nothing visible
+    stats._occludedShapes += cullOccludedShapes(casters);
+
+    std::vector<OuterEdges> outerEdges(casters.size());
+
+    std::vector<int> innerBoundaryIndices;
+    std::vector<sf::Vector2f> innerBoundaryVectors;
+
+    unsigned int castersCount = casters.size();
+    mShadows.reserve(castersCount);
+    for (unsigned int i = 0; i < castersCount; ++i) 
+	{
+        LightShape* pLightShape = casters[i];
+
+		// Hard shadows only need the silhouette seen from the cast center, without penumbras
+		Shadow shadow;
+		if (!soft)
+		{
+			if (getHardBoundaries(shadow._outerStart, shadow._outerEnd, *pLightShape, castCenter))
+			{
+				shadow._shape = pLightShape;
+				shadow._outerStartVector = shadow._outerStart - castCenter;
+				shadow._outerEndVector = shadow._outerEnd - castCenter;
+				shadow._antumbra = false;
+				mShadows.push_back(std::move(shadow));
+			}
+			continue;
+		}
+
+		// Get boundaries
+		innerBoundaryIndices.clear();
+		innerBoundaryVectors.clear();
+		getPenumbrasPoint(shadow._penumbras, innerBoundaryIndices, innerBoundaryVectors, outerEdges[i]._outerBoundaryIndices, outerEdges[i]._outerBoundaryVectors, *pLightShape, convexSilhouetteThreshold);
+
+		if (innerBoundaryIndices.size() != 2 || outerEdges[i]._outerBoundaryIndices.size() != 2)
+		{
+			continue;
+		}
+
+		shadow._shape = pLightShape;
+		shadow._outerStart = pLightShape->getTransform().transformPoint(pLightShape->getPoint(outerEdges[i]._outerBoundaryIndices[0]));
+		shadow._outerEnd = pLightShape->getTransform().transformPoint(pLightShape->getPoint(outerEdges[i]._outerBoundaryIndices[1]));
+		shadow._outerStartVector = outerEdges[i]._outerBoundaryVectors[0];
+		shadow._outerEndVector = outerEdges[i]._outerBoundaryVectors[1];
+
+		sf::Vector2f intersectionOuter;
+		shadow._antumbra = priv::rayIntersect(shadow._outerStart, shadow._outerStartVector, shadow._outerEnd, shadow._outerEndVector, intersectionOuter);
+		if (shadow._antumbra)
+		{
+			sf::Vector2f asi = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[0]));
+			sf::Vector2f bsi = pLightShape->getTransform().transformPoint(pLightShape->getPoint(innerBoundaryIndices[1]));
+			sf::Vector2f adi = innerBoundaryVectors[0];
+			sf::Vector2f bdi = innerBoundaryVectors[1];
+
+			sf::Vector2f intersectionInner;
+			if (priv::rayIntersect(asi, adi, bsi, bdi, intersectionInner))
+			{
+				shadow._maskPoints = { asi, bsi, intersectionInner };
+			}
+			else
+			{
+				shadow._maskPoints = { asi, bsi, bsi + priv::vectorNormalize(bdi) * shadowExtension, asi + priv::vectorNormalize(adi) * shadowExtension };
+			}
+			shadow._regionPoints = shadow._maskPoints;
+			priv::appendPenumbraPoints(shadow._regionPoints, shadow._penumbras, shadowExtension);
+		}
+
+		mShadows.push_back(std::move(shadow));
+    }
+}
+
 void LightPointEmission::setLocalCastCenter(sf::Vector2f const & localCenter)
 {
 	mLocalCastCenter = localCenter;
+	mCacheDirty = true;
 }
 
 sf::Vector2f LightPointEmission::getLocalCastCenter() const
@@ -309,6 +445,7 @@ sf::Vector2f LightPointEmission::getLocalCastCenter() const
 void LightPointEmission::setSourceRadius(float radius)
 {
 	mSourceRadius = radius;
+	mCacheDirty = true;
 }
 
 float LightPointEmission::getSourceRadius() const
@@ -319,6 +456,7 @@ float LightPointEmission::getSourceRadius() const
 void LightPointEmission::setShadowOverExtendMultiplier(float multiplier)
 {
 	mShadowOverExtendMultiplier = multiplier;
+	mCacheDirty = true;
 }
 
 float LightPointEmission::getShadowOverExtendMultiplier() const
@@ -326,11 +464,105 @@ float LightPointEmission::getShadowOverExtendMultiplier() const
 	return mShadowOverExtendMultiplier;
 }
 
+void LightPointEmission::setRadius(float radius)
+{
+	mRadius = radius;
+	mCacheDirty = true;
+}
+
+float LightPointEmission::getRadius() const
+{
+	return mRadius;
+}
+
 sf::FloatRect LightPointEmission::getAABB() const
 {
 	return mSprite.getGlobalBounds();
 }
 
+void LightPointEmission::setCastShadows(bool castShadows)
+{
+	mCastShadows = castShadows;
+}
+
+bool LightPointEmission::castsShadows() const
+{
+	return mCastShadows;
+}
+
+void LightPointEmission::appendEmission(sf::VertexArray& vertices) const
+{
+	priv::appendQuad(vertices, mSprite.getTransform(), mSprite.getTextureRect(), mSprite.getColor());
+}
+
+void LightPointEmission::setStatic(bool staticLight)
+{
+	mStatic = staticLight;
+	mCacheDirty = true;
+	if (!mStatic)
+	{
+		mCacheTexture.reset();
+	}
+}
+
+bool LightPointEmission::isStatic() const
+{
+	return mStatic;
+}
+
+bool LightPointEmission::isCacheValid() const
+{
+	return mCacheTexture != nullptr && !mCacheDirty && mCacheVersion == getVersion();
+}
+
+bool LightPointEmission::isCacheCurrent(const std::vector<priv::QuadtreeOccupant*>& shapes) const
+{
+	return isCacheValid() && mCacheSignature == getShapesSignature(shapes);
+}
+
+void LightPointEmission::validateCache(const std::vector<priv::QuadtreeOccupant*>& shapes, unsigned int frame)
+{
+	mCacheDirty = false;
+	mCacheVersion = getVersion();
+	mCacheSignature = getShapesSignature(shapes);
+	mCacheRenderFrame = frame;
+}
+
+unsigned int LightPointEmission::getCacheRenderFrame() const
+{
+	return mCacheRenderFrame;
+}
+
+unsigned int LightPointEmission::useCache(unsigned int frame)
+{
+	unsigned int previousFrame = mCacheUseFrame;
+	mCacheUseFrame = frame;
+	return previousFrame;
+}
+
+sf::RenderTexture& LightPointEmission::getCacheTexture(const sf::Vector2u& size)
+{
+	if (mCacheTexture == nullptr)
+	{
+		mCacheTexture.reset(new sf::RenderTexture());
+	}
+	if (mCacheTexture->getSize() != size)
+	{
+		mCacheTexture->create(size.x, size.y);
+	}
+	return *mCacheTexture;
+}
+
+const sf::RenderTexture* LightPointEmission::getCacheTexture() const
+{
+	return mCacheTexture.get();
+}
+
+std::size_t LightPointEmission::getShapesSignature(const std::vector<priv::QuadtreeOccupant*>& shapes) const
+{
+	return priv::shapesSignature<LightShape>(shapes);
+}
+
 sf::Vector2f LightPointEmission::getCastCenter() const
 {
 	sf::Transform t = mSprite.getTransform();
@@ -338,88 +570,238 @@ sf::Vector2f LightPointEmission::getCastCenter() const
 	return t.transformPoint(mLocalCastCenter);
 }
 
-void LightPointEmission::getPenumbrasPoint(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape)
+unsigned int LightPointEmission::cullOccludedShapes(std::vector<LightShape*>& casters) const
 {
-	sf::Vector2f sourceCenter = getCastCenter();
-
-	const int numPoints = shape.getPointCount();
+	// Angular coverage around the cast center : each bin stores the distance from which it is in the umbra of a nearer shape
+	const int binCount = 512;
+	const float binAngle = 2.0f * priv::_pi / binCount;
+	std::vector<float> umbraDistances(binCount, std::numeric_limits<float>::max());
 
-	std::vector<bool> bothEdgesBoundaryWindings;
-	bothEdgesBoundaryWindings.reserve(2);
+	sf::Vector2f castCenter = getCastCenter();
 
-	std::vector<bool> oneEdgeBoundaryWindings;
-	oneEdgeBoundaryWindings.reserve(2);
-
-	// Calculate front and back facing sides
-	std::vector<bool> facingFrontBothEdges;
-	facingFrontBothEdges.reserve(numPoints);
+	struct Candidate
+	{
+		LightShape* _shape;
+		float _minDistance;
+		float _maxDistance;
+		float _minAngle;
+		float _maxAngle;
+	};
+
+	std::vector<Candidate> candidates;
+	candidates.reserve(casters.size());
+	std::vector<LightShape*> surrounding;
+
+	for (LightShape* shape : casters)
+	{
+		Candidate candidate;
+		candidate._shape = shape;
+		candidate._minDistance = std::numeric_limits<float>::max();
+		candidate._maxDistance = 0.0f;
+		candidate._minAngle = 0.0f;
+		candidate._maxAngle = 0.0f;
+
+		unsigned int pointCount = shape->getPointCount();
+		sf::Vector2f first = shape->getTransform().transformPoint(shape->getPoint(0)) - castCenter;
+		float firstAngle = std::atan2(first.y, first.x);
+		for (unsigned int i = 0; i < pointCount; i++)
+		{
+			sf::Vector2f point = shape->getTransform().transformPoint(shape->getPoint(i)) - castCenter;
+			sf::Vector2f next = shape->getTransform().transformPoint(shape->getPoint((i + 1) % pointCount)) - castCenter;
+
+			candidate._minDistance = std::min(candidate._minDistance, priv::segmentDistance(sf::Vector2f(), point, next));
+			candidate._maxDistance = std::max(candidate._maxDistance, priv::vectorMagnitude(point));
+
+			float angle = std::atan2(point.y, point.x) - firstAngle;
+			if (angle > priv::_pi)
+				angle -= 2.0f * priv::_pi;
+			else if (angle <= -priv::_pi)
+				angle += 2.0f * priv::_pi;
+			candidate._minAngle = std::min(candidate._minAngle, angle);
+			candidate._maxAngle = std::max(candidate._maxAngle, angle);
+		}
+		candidate._minAngle += firstAngle;
+		candidate._maxAngle += firstAngle;
 
-	std::vector<bool> facingFrontOneEdge;
-	facingFrontOneEdge.reserve(numPoints);
+		// The cast center is inside or too close : the shape can neither be hidden nor hide others
+		if (candidate._maxAngle - candidate._minAngle >= priv::_pi || candidate._minDistance <= mSourceRadius)
+		{
+			surrounding.push_back(shape);
+		}
+		else
+		{
+			candidates.push_back(candidate);
+		}
+	}
 
-	for (int i = 0; i < numPoints; i++) 
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
 	{
-		sf::Vector2f point = shape.getTransform().transformPoint(shape.getPoint(i));
-		sf::Vector2f nextPoint = shape.getTransform().transformPoint(shape.getPoint((i < numPoints - 1) ? i + 1 : 0));
-
-		sf::Vector2f firstEdgeRay;
-		sf::Vector2f secondEdgeRay;
-		sf::Vector2f firstNextEdgeRay;
-		sf::Vector2f secondNextEdgeRay;
+		return a._minDistance < b._minDistance;
+	});
 
+	unsigned int occludedCount = 0;
+	casters.swap(surrounding);
+	for (const Candidate& candidate : candidates)
+	{
+		// Hidden if every bin it covers is already in the umbra at its distance
+		bool hidden = true;
+		int firstBin = static_cast<int>(std::floor(candidate._minAngle / binAngle));
+		int lastBin = static_cast<int>(std::floor(candidate._maxAngle / binAngle));
+		for (int bin = firstBin; bin <= lastBin && hidden; bin++)
+		{
+			hidden = umbraDistances[(bin % binCount + binCount) % binCount] <= candidate._minDistance;
+		}
+		if (hidden)
 		{
-			sf::Vector2f sourceToPoint = point - sourceCenter;
-			sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -sourceToPoint.y, sourceToPoint.x }) * mSourceRadius;
-			firstEdgeRay = point - (sourceCenter - perpendicularOffset);
-			secondEdgeRay = point - (sourceCenter + perpendicularOffset);
+			occludedCount++;
+			continue;
 		}
+		casters.push_back(candidate._shape);
+
+		// Only the bins fully in the umbra are covered, the umbra is narrower than the shape by the angular size of the source
+		float shrink = std::asin(mSourceRadius / candidate._minDistance);
+		firstBin = static_cast<int>(std::ceil((candidate._minAngle + shrink) / binAngle));
+		lastBin = static_cast<int>(std::floor((candidate._maxAngle - shrink) / binAngle)) - 1;
+		for (int bin = firstBin; bin <= lastBin; bin++)
 		{
-			sf::Vector2f sourceToPoint = nextPoint - sourceCenter;
-			sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -sourceToPoint.y, sourceToPoint.x }) * mSourceRadius;
-			firstNextEdgeRay = nextPoint - (sourceCenter - perpendicularOffset);
-			secondNextEdgeRay = nextPoint - (sourceCenter + perpendicularOffset);
+			float& umbraDistance = umbraDistances[(bin % binCount + binCount) % binCount];
+			umbraDistance = std::min(umbraDistance, candidate._maxDistance);
 		}
+	}
 
-		sf::Vector2f pointToNextPoint = nextPoint - point;
-		sf::Vector2f normal = priv::vectorNormalize(sf::Vector2f(-pointToNextPoint.y, pointToNextPoint.x));
+	return occludedCount;
+}
 
-		// Front facing, mark it
-		facingFrontBothEdges.push_back((priv::vectorDot(firstEdgeRay, normal) > 0.0f && priv::vectorDot(secondEdgeRay, normal) > 0.0f) || (priv::vectorDot(firstNextEdgeRay, normal) > 0.0f && priv::vectorDot(secondNextEdgeRay, normal) > 0.0f));
-		facingFrontOneEdge.push_back((priv::vectorDot(firstEdgeRay, normal) > 0.0f || priv::vectorDot(secondEdgeRay, normal) > 0.0f) || priv::vectorDot(firstNextEdgeRay, normal) > 0.0f || priv::vectorDot(secondNextEdgeRay, normal) > 0.0f);
+bool LightPointEmission::getHardBoundaries(sf::Vector2f& first, sf::Vector2f& second, const LightShape& shape, const sf::Vector2f& castCenter) const
+{
+	unsigned int pointCount = shape.getPointCount();
+	if (pointCount < 3)
+	{
+		return false;
 	}
 
-	// Go through front/back facing list. Where the facing direction switches, there is a boundary
-	for (int i = 1; i < numPoints; i++)
+	// The silhouette points are where the sides switch between facing the cast center and facing away from it
+	const sf::Transform& transform = shape.getTransform();
+	sf::Vector2f previous = transform.transformPoint(shape.getPoint(pointCount - 1));
+	sf::Vector2f current = transform.transformPoint(shape.getPoint(0));
+	bool previousFacing = priv::vectorCross(current - previous, castCenter - previous) > 0.0f;
+	unsigned int found = 0;
+	for (unsigned int i = 0; i < pointCount; i++)
 	{
-		if (facingFrontBothEdges[i] != facingFrontBothEdges[i - 1])
+		sf::Vector2f next = transform.transformPoint(shape.getPoint((i + 1) % pointCount));
+		bool facing = priv::vectorCross(next - current, castCenter - current) > 0.0f;
+		if (facing != previousFacing)
 		{
-			innerBoundaryIndices.push_back(i);
-			bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[i]);
+			if (found == 2)
+			{
+				return false;
+			}
+			(found == 0 ? first : second) = current;
+			found++;
 		}
+		previousFacing = facing;
+		current = next;
 	}
+	return found == 2;
+}
 
-	// Check looping indices separately
-	if (facingFrontBothEdges[0] != facingFrontBothEdges[numPoints - 1]) 
+bool LightPointEmission::isInRadius(const LightShape& shape, const sf::Vector2f& castCenter) const
+{
+	if (!priv::rectIntersectsCircle(shape.getAABB(), castCenter, mRadius))
 	{
-		innerBoundaryIndices.push_back(0);
-		bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[0]);
+		return false;
 	}
 
-	// Go through front/back facing list. Where the facing direction switches, there is a boundary
-	for (int i = 1; i < numPoints; i++)
+	// Exact test : a side is in the radius, or the cast center is inside the shape
+	unsigned int pointCount = shape.getPointCount();
+	bool leftOfAll = true;
+	bool rightOfAll = true;
+	for (unsigned int i = 0; i < pointCount; i++)
 	{
-		if (facingFrontOneEdge[i] != facingFrontOneEdge[i - 1]) 
+		sf::Vector2f point = shape.getTransform().transformPoint(shape.getPoint(i));
+		sf::Vector2f next = shape.getTransform().transformPoint(shape.getPoint((i + 1) % pointCount));
+		if (priv::segmentDistance(castCenter, point, next) <= mRadius)
 		{
-			outerBoundaryIndices.push_back(i);
-			oneEdgeBoundaryWindings.push_back(facingFrontOneEdge[i]);
+			return true;
 		}
+		float side = priv::vectorCross(next - point, castCenter - point);
+		leftOfAll = leftOfAll && side >= 0.0f;
+		rightOfAll = rightOfAll && side <= 0.0f;
 	}
+	return pointCount >= 3 && (leftOfAll || rightOfAll);
+}
+
+void LightPointEmission::getPenumbrasPoint(std::vector<priv::Penumbra>& penumbras, std::vector<int>& innerBoundaryIndices, std::vector<sf::Vector2f>& innerBoundaryVectors, std::vector<int>& outerBoundaryIndices, std::vector<sf::Vector2f>& outerBoundaryVectors, const LightShape& shape, unsigned int convexSilhouetteThreshold)
+{
+	sf::Vector2f sourceCenter = getCastCenter();
+
+	const int numPoints = shape.getPointCount();
+
+	std::vector<bool> bothEdgesBoundaryWindings;
+	bothEdgesBoundaryWindings.reserve(2);
+
+	std::vector<bool> oneEdgeBoundaryWindings;
+	oneEdgeBoundaryWindings.reserve(2);
 
-	// Check looping indices separately
-	if (facingFrontOneEdge[0] != facingFrontOneEdge[numPoints - 1]) 
+	// Large convex shapes : search the boundaries around the tangent points instead of walking every side
+	bool boundariesFound = numPoints >= static_cast<int>(convexSilhouetteThreshold) && getConvexBoundaries(innerBoundaryIndices, bothEdgesBoundaryWindings, outerBoundaryIndices, oneEdgeBoundaryWindings, shape, sourceCenter);
+
+	if (!boundariesFound)
 	{
-		outerBoundaryIndices.push_back(0);
-		oneEdgeBoundaryWindings.push_back(facingFrontOneEdge[0]);
+		innerBoundaryIndices.clear();
+		bothEdgesBoundaryWindings.clear();
+		outerBoundaryIndices.clear();
+		oneEdgeBoundaryWindings.clear();
+
+		// Calculate front and back facing sides
+		std::vector<bool> facingFrontBothEdges;
+		facingFrontBothEdges.reserve(numPoints);
+
+		std::vector<bool> facingFrontOneEdge;
+		facingFrontOneEdge.reserve(numPoints);
+
+		for (int i = 0; i < numPoints; i++) 
+		{
+			bool bothEdges;
+			bool oneEdge;
+			getFacing(bothEdges, oneEdge, shape, i, sourceCenter);
+			facingFrontBothEdges.push_back(bothEdges);
+			facingFrontOneEdge.push_back(oneEdge);
+		}
+
+		// Go through front/back facing list. Where the facing direction switches, there is a boundary
+		for (int i = 1; i < numPoints; i++)
+		{
+			if (facingFrontBothEdges[i] != facingFrontBothEdges[i - 1])
+			{
+				innerBoundaryIndices.push_back(i);
+				bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[i]);
+			}
+		}
+
+		// Check looping indices separately
+		if (facingFrontBothEdges[0] != facingFrontBothEdges[numPoints - 1]) 
+		{
+			innerBoundaryIndices.push_back(0);
+			bothEdgesBoundaryWindings.push_back(facingFrontBothEdges[0]);
+		}
+
+		// Go through front/back facing list. Where the facing direction switches, there is a boundary
+		for (int i = 1; i < numPoints; i++)
+		{
+			if (facingFrontOneEdge[i] != facingFrontOneEdge[i - 1]) 
+			{
+				outerBoundaryIndices.push_back(i);
+				oneEdgeBoundaryWindings.push_back(facingFrontOneEdge[i]);
+			}
+		}
+
+		// Check looping indices separately
+		if (facingFrontOneEdge[0] != facingFrontOneEdge[numPoints - 1]) 
+		{
+			outerBoundaryIndices.push_back(0);
+			oneEdgeBoundaryWindings.push_back(facingFrontOneEdge[0]);
+		}
 	}
 
 	// Compute outer boundary vectors
@@ -606,6 +988,99 @@ void LightPointEmission::getPenumbrasPoint(std::vector<priv::Penumbra>& penumbra
 	}
 }
 
+void LightPointEmission::getFacing(bool& facingFrontBothEdges, bool& facingFrontOneEdge, const LightShape& shape, int index, const sf::Vector2f& sourceCenter) const
+{
+	const int numPoints = shape.getPointCount();
+
+	sf::Vector2f point = shape.getTransform().transformPoint(shape.getPoint(index));
+	sf::Vector2f nextPoint = shape.getTransform().transformPoint(shape.getPoint((index < numPoints - 1) ? index + 1 : 0));
+
+	sf::Vector2f firstEdgeRay;
+	sf::Vector2f secondEdgeRay;
+	sf::Vector2f firstNextEdgeRay;
+	sf::Vector2f secondNextEdgeRay;
+
+	{
+		sf::Vector2f sourceToPoint = point - sourceCenter;
+		sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -sourceToPoint.y, sourceToPoint.x }) * mSourceRadius;
+		firstEdgeRay = point - (sourceCenter - perpendicularOffset);
+		secondEdgeRay = point - (sourceCenter + perpendicularOffset);
+	}
+	{
+		sf::Vector2f sourceToPoint = nextPoint - sourceCenter;
+		sf::Vector2f perpendicularOffset = priv::vectorNormalize({ -sourceToPoint.y, sourceToPoint.x }) * mSourceRadius;
+		firstNextEdgeRay = nextPoint - (sourceCenter - perpendicularOffset);
+		secondNextEdgeRay = nextPoint - (sourceCenter + perpendicularOffset);
+	}
+
+	sf::Vector2f pointToNextPoint = nextPoint - point;
+	sf::Vector2f normal = priv::vectorNormalize(sf::Vector2f(-pointToNextPoint.y, pointToNextPoint.x));
+
+	// Front facing, mark it
+	facingFrontBothEdges = (priv::vectorDot(firstEdgeRay, normal) > 0.0f && priv::vectorDot(secondEdgeRay, normal) > 0.0f) || (priv::vectorDot(firstNextEdgeRay, normal) > 0.0f && priv::vectorDot(secondNextEdgeRay, normal) > 0.0f);
+	facingFrontOneEdge = (priv::vectorDot(firstEdgeRay, normal) > 0.0f || priv::vectorDot(secondEdgeRay, normal) > 0.0f) || priv::vectorDot(firstNextEdgeRay, normal) > 0.0f || priv::vectorDot(secondNextEdgeRay, normal) > 0.0f;
+}
+
+bool LightPointEmission::getConvexBoundaries(std::vector<int>& innerBoundaryIndices, std::vector<bool>& bothEdgesBoundaryWindings, std::vector<int>& outerBoundaryIndices, std::vector<bool>& oneEdgeBoundaryWindings, const LightShape& shape, const sf::Vector2f& sourceCenter) const
+{
+	int tangents[2];
+	if (!shape.getTangents(sourceCenter, tangents[0], tangents[1]))
+	{
+		return false;
+	}
+
+	const int numPoints = shape.getPointCount();
+
+	// The facing direction of a convex shape switches only twice, near the tangent points
+	for (int edges = 0; edges < 2; edges++)
+	{
+		bool bothEdges = (edges == 0);
+		int boundaries[2];
+		bool windings[2];
+		for (int t = 0; t < 2; t++)
+		{
+			boundaries[t] = -1;
+			for (int step = 0; step <= numPoints / 2 && boundaries[t] < 0; step++)
+			{
+				for (int side = 0; side < 2 && boundaries[t] < 0; side++)
+				{
+					int index = ((tangents[t] + ((side == 0) ? step : -step)) % numPoints + numPoints) % numPoints;
+					bool facingBoth, facingOne, prevFacingBoth, prevFacingOne;
+					getFacing(facingBoth, facingOne, shape, index, sourceCenter);
+					getFacing(prevFacingBoth, prevFacingOne, shape, (index > 0) ? index - 1 : numPoints - 1, sourceCenter);
+					bool facing = (bothEdges) ? facingBoth : facingOne;
+					if (facing != ((bothEdges) ? prevFacingBoth : prevFacingOne))
+					{
+						boundaries[t] = index;
+						windings[t] = facing;
+					}
+				}
+			}
+			if (boundaries[t] < 0)
+			{
+				return false;
+			}
+		}
+		if (boundaries[0] == boundaries[1])
+		{
+			return false;
+		}
+
+		// Same order as the linear walk : increasing indices, 0 last
+		int first = (boundaries[0] == 0) ? numPoints : boundaries[0];
+		int second = (boundaries[1] == 0) ? numPoints : boundaries[1];
+		int order = (first < second) ? 0 : 1;
+		std::vector<int>& indices = (bothEdges) ? innerBoundaryIndices : outerBoundaryIndices;
+		std::vector<bool>& boundaryWindings = (bothEdges) ? bothEdgesBoundaryWindings : oneEdgeBoundaryWindings;
+		indices.push_back(boundaries[order]);
+		indices.push_back(boundaries[1 - order]);
+		boundaryWindings.push_back(windings[order]);
+		boundaryWindings.push_back(windings[1 - order]);
+	}
+
+	return true;
+}
+
 void LightPointEmission::draw(sf::RenderTarget& target, sf::RenderStates states) const
 {
 	target.draw(mSprite, states);
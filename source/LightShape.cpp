@@ -9,12 +9,20 @@ LightShape::LightShape()
 	, sf::Drawable()
 	, mShape()
 	, mRenderLightOver(true)
+	, mConvexityChanged(true)
+	, mConvex(false)
+	, mLocalClockwise(false)
+	, mConvexParts()
+	, mConvexPartsChanged(true)
+	, mConvexPartsVersion(0)
 {
 }
 
 void LightShape::setPointCount(unsigned int pointCount)
 {
 	mShape.setPointCount(pointCount);
+	mConvexityChanged = true;
+	mConvexPartsChanged = true;
 	quadtreeAABBChanged();
 }
 
@@ -26,6 +34,8 @@ unsigned int LightShape::getPointCount() const
 void LightShape::setPoint(unsigned int index, const sf::Vector2f& point)
 {
 	mShape.setPoint(index, point);
+	mConvexityChanged = true;
+	mConvexPartsChanged = true;
 	quadtreeAABBChanged();
 }
 
@@ -37,6 +47,10 @@ sf::Vector2f LightShape::getPoint(unsigned int index) const
 void LightShape::setColor(const sf::Color& color)
 {
 	mShape.setFillColor(color);
+	for (auto& part : mConvexParts)
+	{
+		part->setColor(color);
+	}
 }
 
 const sf::Color& LightShape::getColor() const
@@ -144,6 +158,10 @@ const sf::Vector2f& LightShape::getOrigin() const
 void LightShape::setRenderLightOver(bool renderLightOver)
 {
 	mRenderLightOver = renderLightOver;
+	for (auto& part : mConvexParts)
+	{
+		part->setRenderLightOver(renderLightOver);
+	}
 }
 
 bool LightShape::renderLightOver() const
@@ -156,9 +174,449 @@ sf::FloatRect LightShape::getAABB() const
 	return mShape.getGlobalBounds();
 }
 
+bool LightShape::isConvex() const
+{
+	if (mConvexityChanged)
+	{
+		updateConvexity();
+	}
+	return mConvex;
+}
+
+bool LightShape::getTangents(const sf::Vector2f& point, int& first, int& second) const
+{
+	if (!isConvex())
+	{
+		return false;
+	}
+
+	int count = getPointCount();
+	bool reversed = isClockwise();
+	int right = searchTangent(point, true, reversed);
+	int left = searchTangent(point, false, reversed);
+	if (right < 0 || left < 0 || right == left)
+	{
+		return false;
+	}
+
+	first = (reversed) ? (count - right) % count : right;
+	second = (reversed) ? (count - left) % count : left;
+	return true;
+}
+
+bool LightShape::getExtremes(const sf::Vector2f& direction, int& first, int& second) const
+{
+	if (!isConvex())
+	{
+		return false;
+	}
+
+	int count = getPointCount();
+	bool reversed = isClockwise();
+	int max = searchExtreme(direction, reversed);
+	int min = searchExtreme(-direction, reversed);
+	if (max < 0 || min < 0 || max == min)
+	{
+		return false;
+	}
+
+	first = (reversed) ? (count - max) % count : max;
+	second = (reversed) ? (count - min) % count : min;
+	return true;
+}
+
+unsigned int LightShape::getConvexPartCount() const
+{
+	updateConvexParts();
+	return mConvexParts.size();
+}
+
+LightShape& LightShape::getConvexPart(unsigned int index) const
+{
+	updateConvexParts();
+	return *mConvexParts[index];
+}
+
+sf::Vector2f LightShape::getCounterClockwisePoint(int index, bool reversed) const
+{
+	int count = getPointCount();
+	index %= count;
+	if (index < 0)
+	{
+		index += count;
+	}
+	if (reversed)
+	{
+		index = (count - index) % count;
+	}
+	return getTransform().transformPoint(getPoint(index));
+}
+
+bool LightShape::isClockwise() const
+{
+	// A negative determinant mirrors the shape, which flips the winding
+	const float* matrix = getTransform().getMatrix();
+	bool mirrored = (matrix[0] * matrix[5] - matrix[1] * matrix[4]) < 0.0f;
+	return mLocalClockwise != mirrored;
+}
+
+int LightShape::searchTangent(const sf::Vector2f& point, bool right, bool reversed) const
+{
+	// Binary search from "Tangents to a Convex Polygon" (Dan Sunday)
+	// above(a, b) : a is on the left of the line from point to b
+	const int count = getPointCount();
+
+	sf::Vector2f first = getCounterClockwisePoint(0, reversed) - point;
+	sf::Vector2f next = getCounterClockwisePoint(1, reversed) - point;
+	sf::Vector2f last = getCounterClockwisePoint(count - 1, reversed) - point;
+	if (right && priv::vectorCross(next, first) < 0.0f && !(priv::vectorCross(last, first) > 0.0f))
+	{
+		return 0;
+	}
+	if (!right && priv::vectorCross(last, first) > 0.0f && !(priv::vectorCross(next, first) < 0.0f))
+	{
+		return 0;
+	}
+
+	int a = 0;
+	int b = count;
+	while (b - a > 1)
+	{
+		int c = (a + b) / 2;
+		sf::Vector2f pointA = getCounterClockwisePoint(a, reversed) - point;
+		sf::Vector2f pointC = getCounterClockwisePoint(c, reversed) - point;
+		bool downC = priv::vectorCross(getCounterClockwisePoint(c + 1, reversed) - point, pointC) < 0.0f;
+		float prevC = priv::vectorCross(getCounterClockwisePoint(c - 1, reversed) - point, pointC);
+		float aboveA = priv::vectorCross(pointA, pointC);
+		if (right)
+		{
+			// The right tangent is the maximum of the ordering
+			if (downC && !(prevC > 0.0f))
+			{
+				return c;
+			}
+			if (priv::vectorCross(getCounterClockwisePoint(a + 1, reversed) - point, pointA) > 0.0f)
+			{
+				if (downC || aboveA > 0.0f)
+					b = c;
+				else
+					a = c;
+			}
+			else
+			{
+				if (downC && aboveA < 0.0f)
+					b = c;
+				else
+					a = c;
+			}
+		}
+		else
+		{
+			// The left tangent is the minimum of the ordering
+			if (prevC > 0.0f && !downC)
+			{
+				return c;
+			}
+			if (priv::vectorCross(getCounterClockwisePoint(a + 1, reversed) - point, pointA) < 0.0f)
+			{
+				if (!downC || aboveA < 0.0f)
+					b = c;
+				else
+					a = c;
+			}
+			else
+			{
+				if (!downC && aboveA > 0.0f)
+					b = c;
+				else
+					a = c;
+			}
+		}
+	}
+
+	return -1;
+}
+
+int LightShape::searchExtreme(const sf::Vector2f& direction, bool reversed) const
+{
+	// Binary search from "Extreme Points of Convex Polygons" (Dan Sunday)
+	const int count = getPointCount();
+
+	sf::Vector2f first = getCounterClockwisePoint(0, reversed);
+	bool upA = priv::vectorDot(direction, getCounterClockwisePoint(1, reversed) - first) > 0.0f;
+	if (!upA && !(priv::vectorDot(direction, getCounterClockwisePoint(count - 1, reversed) - first) > 0.0f))
+	{
+		return 0;
+	}
+
+	int a = 0;
+	int b = count;
+	while (b - a > 1)
+	{
+		int c = (a + b) / 2;
+		sf::Vector2f pointC = getCounterClockwisePoint(c, reversed);
+		bool upC = priv::vectorDot(direction, getCounterClockwisePoint(c + 1, reversed) - pointC) > 0.0f;
+		if (!upC && !(priv::vectorDot(direction, getCounterClockwisePoint(c - 1, reversed) - pointC) > 0.0f))
+		{
+			return c;
+		}
+
+		float aboveA = priv::vectorDot(direction, getCounterClockwisePoint(a, reversed) - pointC);
+		if ((upA && (!upC || aboveA > 0.0f)) || (!upA && !upC && aboveA < 0.0f))
+		{
+			b = c;
+		}
+		else
+		{
+			a = c;
+			upA = upC;
+		}
+	}
+
+	return -1;
+}
+
+void LightShape::updateConvexity() const
+{
+	// Convex if every turn goes the same way and the outline winds only once
+	int count = getPointCount();
+	float orientation = 0.0f;
+	float area = 0.0f;
+	int xSignChanges = 0;
+	int ySignChanges = 0;
+	float prevDx = 0.0f;
+	float prevDy = 0.0f;
+	float firstDx = 0.0f;
+	float firstDy = 0.0f;
+
+	mConvex = (count >= 3);
+	for (int i = 0; i < count && mConvex; i++)
+	{
+		sf::Vector2f point = getPoint(i);
+		sf::Vector2f edge = getPoint((i + 1) % count) - point;
+		sf::Vector2f nextEdge = getPoint((i + 2) % count) - getPoint((i + 1) % count);
+
+		float turn = priv::vectorCross(edge, nextEdge);
+		if (turn != 0.0f)
+		{
+			if (orientation * turn < 0.0f)
+			{
+				mConvex = false;
+			}
+			orientation = turn;
+		}
+		area += priv::vectorCross(point, point + edge);
+
+		if (edge.x != 0.0f)
+		{
+			if (prevDx * edge.x < 0.0f)
+				xSignChanges++;
+			if (firstDx == 0.0f)
+				firstDx = edge.x;
+			prevDx = edge.x;
+		}
+		if (edge.y != 0.0f)
+		{
+			if (prevDy * edge.y < 0.0f)
+				ySignChanges++;
+			if (firstDy == 0.0f)
+				firstDy = edge.y;
+			prevDy = edge.y;
+		}
+	}
+
+	// Close the sign changes loop
+	if (prevDx * firstDx < 0.0f)
+		xSignChanges++;
+	if (prevDy * firstDy < 0.0f)
+		ySignChanges++;
+
+	mConvex = mConvex && orientation != 0.0f && xSignChanges <= 2 && ySignChanges <= 2;
+	mLocalClockwise = (area < 0.0f);
+	mConvexityChanged = false;
+}
+
+void LightShape::updateConvexParts() const
+{
+	if (mConvexPartsChanged)
+	{
+		mConvexParts.clear();
+		mConvexPartsVersion = 0;
+		mConvexPartsChanged = false;
+
+		int count = getPointCount();
+		if (isConvex() || count < 3)
+		{
+			return;
+		}
+
+		// Self-intersecting shapes have no valid decomposition, they cast their shadows as a whole
+		for (int i = 0; i < count; i++)
+		{
+			for (int j = i + 2; j < count; j++)
+			{
+				if ((j + 1) % count == i)
+				{
+					continue;
+				}
+				if (priv::segmentsCross(getPoint(i), getPoint((i + 1) % count), getPoint(j), getPoint((j + 1) % count)))
+				{
+					return;
+				}
+			}
+		}
+
+		// Walk the points counter clockwise
+		std::vector<int> remaining(count);
+		for (int i = 0; i < count; i++)
+		{
+			remaining[i] = (mLocalClockwise) ? count - 1 - i : i;
+		}
+
+		// Ear clipping
+		std::vector<std::vector<int>> polygons;
+		while (remaining.size() > 3)
+		{
+			int n = remaining.size();
+			int ear = -1;
+			for (int i = 0; i < n && ear < 0; i++)
+			{
+				sf::Vector2f a = getPoint(remaining[(i + n - 1) % n]);
+				sf::Vector2f b = getPoint(remaining[i]);
+				sf::Vector2f c = getPoint(remaining[(i + 1) % n]);
+				if (priv::vectorCross(b - a, c - b) <= 0.0f)
+				{
+					continue;
+				}
+
+				bool empty = true;
+				for (int j = 0; j < n && empty; j++)
+				{
+					if (j == i || j == (i + n - 1) % n || j == (i + 1) % n)
+					{
+						continue;
+					}
+					sf::Vector2f p = getPoint(remaining[j]);
+					if (priv::vectorCross(b - a, p - a) >= 0.0f && priv::vectorCross(c - b, p - b) >= 0.0f && priv::vectorCross(a - c, p - c) >= 0.0f)
+					{
+						empty = false;
+					}
+				}
+				if (empty)
+				{
+					ear = i;
+				}
+			}
+
+			// No ear : the polygon is not simple (touching sides), keep the shape whole
+			if (ear < 0)
+			{
+				return;
+			}
+
+			polygons.push_back({ remaining[(ear + n - 1) % n], remaining[ear], remaining[(ear + 1) % n] });
+			remaining.erase(remaining.begin() + ear);
+		}
+		if (priv::vectorCross(getPoint(remaining[1]) - getPoint(remaining[0]), getPoint(remaining[2]) - getPoint(remaining[1])) > 0.0f)
+		{
+			polygons.push_back(remaining);
+		}
+
+		// Merge the polygons sharing a diagonal while the result stays convex
+		bool merged = true;
+		while (merged)
+		{
+			merged = false;
+			for (std::size_t a = 0; a < polygons.size() && !merged; a++)
+			{
+				for (std::size_t b = a + 1; b < polygons.size() && !merged; b++)
+				{
+					const std::vector<int>& pa = polygons[a];
+					const std::vector<int>& pb = polygons[b];
+					int na = pa.size();
+					int nb = pb.size();
+					for (int i = 0; i < na && !merged; i++)
+					{
+						for (int j = 0; j < nb && !merged; j++)
+						{
+							if (pa[i] != pb[(j + 1) % nb] || pa[(i + 1) % na] != pb[j])
+							{
+								continue;
+							}
+
+							// Walk a from the end of the diagonal back to its start, then the rest of b
+							std::vector<int> polygon;
+							polygon.reserve(na + nb - 2);
+							for (int k = 0; k < na; k++)
+							{
+								polygon.push_back(pa[(i + 1 + k) % na]);
+							}
+							for (int k = 2; k < nb; k++)
+							{
+								polygon.push_back(pb[(j + k) % nb]);
+							}
+
+							bool convex = true;
+							int n = polygon.size();
+							for (int k = 0; k < n && convex; k++)
+							{
+								sf::Vector2f point = getPoint(polygon[k]);
+								convex = priv::vectorCross(getPoint(polygon[(k + 1) % n]) - point, getPoint(polygon[(k + 2) % n]) - getPoint(polygon[(k + 1) % n])) >= 0.0f;
+							}
+
+							if (convex)
+							{
+								polygons[a] = polygon;
+								polygons.erase(polygons.begin() + b);
+								merged = true;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		for (const auto& polygon : polygons)
+		{
+			std::unique_ptr<LightShape> part(new LightShape());
+			part->setPointCount(polygon.size());
+			for (std::size_t i = 0; i < polygon.size(); i++)
+			{
+				part->setPoint(i, getPoint(polygon[i]));
+			}
+			part->setColor(getColor());
+			part->setRenderLightOver(mRenderLightOver);
+			mConvexParts.push_back(std::move(part));
+		}
+	}
+
+	// The parts follow the transform of the shape
+	if (mConvexPartsVersion != getVersion())
+	{
+		for (auto& part : mConvexParts)
+		{
+			part->setPosition(getPosition());
+			part->setOrigin(getOrigin());
+			part->setRotation(getRotation());
+			part->setScale(getScale());
+		}
+		mConvexPartsVersion = getVersion();
+	}
+}
+
 void LightShape::draw(sf::RenderTarget& target, sf::RenderStates states) const
 {
-	target.draw(mShape, states);
+	if (getConvexPartCount() > 0)
+	{
+		for (const auto& part : mConvexParts)
+		{
+			target.draw(*part, states);
+		}
+	}
+	else
+	{
+		target.draw(mShape, states);
+	}
 }
 
 } // namespace ltbl
@@ -8,19 +8,51 @@ LightSystem::LightSystem(bool useNormals)
 	, mUnshadowShader()
 	, mLightOverShapeShader()
 	, mNormalsShader()
+	, mLightTileShader()
 	, mLightShapeQuadtree(sf::FloatRect())
 	, mLightPointEmissionQuadtree(sf::FloatRect())
+	, mNormalSpriteQuadtree(sf::FloatRect())
 	, mPointEmissionLights()
 	, mDirectionEmissionLights()
 	, mLightShapes()
+	, mNormalSprites()
+	, mTileMaps()
 	, mLightTempTexture()
 	, mEmissionTempTexture()
 	, mAntumbraTempTexture()
 	, mCompositionTexture()
 	, mNormalsTexture()
+	, mBufferSize()
+	, mNormalsBatches()
+	, mNormalsView()
+	, mNormalsValid(false)
+	, mNormalsFrame(0)
+	, mDrawnNormals()
+	, mNormalsDirty()
+	, mNormalsDirtyEmpty(true)
+	, mRenderedNormals()
 	, mDirectionEmissionRange(1000.0f)
 	, mDirectionEmissionRadiusMultiplier(1.1f)
 	, mAmbientColor(sf::Color(16, 16, 16))
+	, mConvexSilhouetteThreshold(32)
+	, mLightBufferDownscale(1)
+	, mLightUpdateBudget(0)
+	, mLightUpdates(0)
+	, mHardShadowSize(0.0f)
+	, mNoShadowSize(0.0f)
+	, mLightTileSize(0)
+	, mFrameCount(0)
+	, mRenderStats()
+	, mLightAtlas()
+	, mLightAtlasVertices(sf::Triangles)
+	, mPendingLights()
+	, mPendingShapes()
+	, mEmissionBatches()
+	, mLightTileTexture()
+	, mLightTileData()
+	, mLightTileVertices(sf::Triangles)
+	, mAmortizedLights()
+	, mLightShapesQueries()
 	, mUseNormals(useNormals)
 {
 	// Load Texture
@@ -28,9 +60,10 @@ LightSystem::LightSystem(bool useNormals)
 	mPenumbraTexture.setSmooth(true);
 
 	// Load Shaders
-	mUnshadowShader.loadFromMemory(priv::unshadowFragment, sf::Shader::Fragment);
+	mUnshadowShader.loadFromMemory(priv::unshadowBatchFragment, sf::Shader::Fragment);
 	mLightOverShapeShader.loadFromMemory(priv::lightOverShapeFragment, sf::Shader::Fragment);
 	mNormalsShader.loadFromMemory(priv::normalFragment, sf::Shader::Fragment);
+	mLightTileShader.loadFromMemory(priv::tiledLightFragment, sf::Shader::Fragment);
 }
 
 void LightSystem::create(const sf::FloatRect& rootRegion, const sf::Vector2u& imageSize)
@@ -40,34 +73,78 @@ void LightSystem::create(const sf::FloatRect& rootRegion, const sf::Vector2u& im
 	// Quadtrees
     mLightShapeQuadtree.create(rootRegion, 6, 6);
     mLightPointEmissionQuadtree.create(rootRegion, 6, 6);
+    mNormalSpriteQuadtree.create(rootRegion, 6, 6);
 
 	update(imageSize);
 }
 
 void LightSystem::render(sf::RenderTarget& target)
 {
-	sf::View view = target.getView();
+	render(std::vector<std::pair<sf::RenderTarget*, sf::View>>(1, std::make_pair(&target, target.getView())));
+}
 
-	if (target.getSize() != mLightTempTexture.getSize())
+void LightSystem::render(const std::vector<std::pair<sf::RenderTarget*, sf::View>>& views)
+{
+	for (auto itr = mTileMaps.begin(); itr != mTileMaps.end(); itr++)
 	{
-		update(target.getSize());
+		(*itr)->update();
 	}
 
 	mLightShapeQuadtree.update();
 	mLightPointEmissionQuadtree.update();
+	mNormalSpriteQuadtree.update();
 
-	sf::FloatRect viewBounds = sf::FloatRect(view.getCenter() - view.getSize() * 0.5f, view.getSize());
+	mRenderStats = RenderStats();
+	mFrameCount++;
+	mLightUpdates = 0;
 
-	mNormalsTexture.clear(sf::Color(127u, 127u, 255u));
-	mNormalsTexture.setView(view);
-	for (auto itr = mNormalSprites.begin(); itr != mNormalSprites.end(); itr++)
+	// The sprites rendered since the last pass are read once, each view redraws the visible ones
+	mRenderedNormals.clear();
+	if (mUseNormals)
 	{
-		if ((*itr) != nullptr && (*itr)->isTurnedOn())
+		std::vector<priv::QuadtreeOccupant*> viewNormalSprites;
+		for (const auto& view : views)
 		{
-			(*itr)->renderNormals(mNormalsTexture);
+			mNormalSpriteQuadtree.query(sf::FloatRect(view.second.getCenter() - view.second.getSize() * 0.5f, view.second.getSize()), viewNormalSprites);
+		}
+
+		// A sprite under several views is only kept once, its flag is reset the first time
+		for (const auto& occupant : viewNormalSprites)
+		{
+			Sprite* sprite = static_cast<Sprite*>(occupant);
+			if (sprite->consumeRenderNormals() && sprite->isTurnedOn() && sprite->getNormalsTexture() != nullptr)
+			{
+				mRenderedNormals.push_back(sprite);
+			}
 		}
 	}
-	mNormalsTexture.display();
+
+	// The shapes of the point lights and their shadows are computed once in the pass, then rasterized for each view
+	for (const auto& view : views)
+	{
+		renderView(*view.first, view.second);
+	}
+}
+
+void LightSystem::renderView(sf::RenderTarget& target, const sf::View& targetView)
+{
+	// The render textures are smaller than the target when the light buffer is downscaled
+	sf::Vector2u bufferSize(std::max(1u, target.getSize().x / mLightBufferDownscale), std::max(1u, target.getSize().y / mLightBufferDownscale));
+	if (bufferSize != mBufferSize)
+	{
+		update(bufferSize);
+	}
+
+	// The render textures may be bigger than the buffer, the view draws in their top left part
+	sf::View view = targetView;
+	view.setViewport(priv::viewportInTexture(targetView.getViewport(), bufferSize, mLightTempTexture.getSize()));
+
+	sf::FloatRect viewBounds = sf::FloatRect(view.getCenter() - view.getSize() * 0.5f, view.getSize());
+
+	if (mUseNormals)
+	{
+		renderNormals(view, viewBounds);
+	}
 
 
     mCompositionTexture.clear(mAmbientColor);
@@ -77,8 +154,7 @@ void LightSystem::render(sf::RenderTarget& target)
 
     // --- Point lights
 
-    std::vector<priv::QuadtreeOccupant*> lightShapes;
-    sf::Sprite lightTempSprite(mLightTempTexture.getTexture());
+    mLightAtlas.reset(mLightTempTexture.getSize());
 
 	// Query lights
 	std::vector<priv::QuadtreeOccupant*> viewPointEmissionLights;
@@ -89,21 +165,102 @@ void LightSystem::render(sf::RenderTarget& target)
 		LightPointEmission* light = static_cast<LightPointEmission*>(occupant);
 		if (light != nullptr && light->isTurnedOn())
 		{
-			// Query shapes
-			lightShapes.clear();
-			mLightShapeQuadtree.query(light->getAABB(), lightShapes);
-
-			// Render on Emission Texture : used by lightOverShapeShader
-			mEmissionTempTexture.clear();
-			mEmissionTempTexture.setView(view);
-			mEmissionTempTexture.draw(*light);
-			mEmissionTempTexture.display();
-
-			// Render light
-			light->render(view, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, mLightOverShapeShader, lightShapes, mUseNormals, mNormalsShader);
-			mCompositionTexture.draw(lightTempSprite, sf::BlendAdd);
+			// Lights without shadows are batched by texture, the normals shader needs them one by one
+			if (!light->castsShadows() && !mUseNormals)
+			{
+				sf::VertexArray& batch = mEmissionBatches[light->getTexture()];
+				batch.setPrimitiveType(sf::Triangles);
+				light->appendEmission(batch);
+				mRenderStats._batchedLights++;
+				continue;
+			}
+
+			// Render the light only in its footprint on the screen
+			sf::IntRect footprint = priv::rectToPixels(mLightTempTexture, view, light->getAABB());
+			if (footprint.width <= 0 || footprint.height <= 0)
+			{
+				continue;
+			}
+
+			// Static lights are composited from their cache, the normals are rendered for the current view only
+			if (light->isStatic() && !mUseNormals)
+			{
+				// Query shapes, once for all the views of the pass
+				const std::vector<priv::QuadtreeOccupant*>& lightShapes = queryLightShapes(*light);
+				if (!light->isCacheCurrent(lightShapes))
+				{
+					renderLightCache(*light, lightShapes);
+				}
+				else
+				{
+					mRenderStats._cachedLights++;
+				}
+				compositeLightCache(*light, view);
+				continue;
+			}
+
+			// With an update budget, the lights are composited from their cache and only the most important ones are rendered again
+			if (mLightUpdateBudget > 0 && !mUseNormals)
+			{
+				// Moving and newly visible lights are always rendered again
+				unsigned int lastUse = light->useCache(mFrameCount);
+				bool newlyVisible = lastUse + 1 != mFrameCount && lastUse != mFrameCount;
+				float priority = std::numeric_limits<float>::max();
+				if (light->isCacheValid() && !newlyVisible)
+				{
+					// Bigger on the screen, nearer to the center, older, and with moving shapes first
+					float area = footprint.width * footprint.height / static_cast<float>(mBufferSize.x * mBufferSize.y);
+					float distance = priv::vectorMagnitude(priv::rectCenter(light->getAABB()) - view.getCenter()) / priv::vectorMagnitude(view.getSize());
+					float age = static_cast<float>(mFrameCount - light->getCacheRenderFrame());
+					float motion = light->isCacheCurrent(queryLightShapes(*light)) ? 1.0f : 4.0f;
+					priority = area * age * motion / (1.0f + distance);
+				}
+				mAmortizedLights.push_back(std::make_pair(priority, light));
+				continue;
+			}
+
+			// Small lights are packed in the atlas and rendered together, the others at their place on the screen
+			bool packed = static_cast<unsigned int>(footprint.width) <= mBufferSize.x / 4 && static_cast<unsigned int>(footprint.height) <= mBufferSize.y / 4;
+			sf::IntRect slot = footprint;
+			if (packed && !mLightAtlas.insert(sf::Vector2i(footprint.width, footprint.height), slot))
+			{
+				flushLightAtlas();
+				mLightAtlas.insert(sf::Vector2i(footprint.width, footprint.height), slot);
+			}
+			else if (!packed)
+			{
+				flushLightAtlas();
+			}
+
+			PendingLight pending;
+			pending._light = light;
+			pending._footprint = footprint;
+			pending._slot = slot;
+			pending._view = priv::viewFromPixels(mLightTempTexture, view, footprint, slot);
+			pending._firstShape = mPendingShapes.size();
+			pending._shapeCount = 0;
+			pending._lod = getShadowLod(*light, view);
+			pending._emission = false;
+
+			// Query shapes, once for all the views of the pass, the lights without shadows at their level of detail don't need them
+			if (pending._lod != priv::ShadowLod::None)
+			{
+				const std::vector<priv::QuadtreeOccupant*>& lightShapes = queryLightShapes(*light);
+				pending._shapeCount = lightShapes.size();
+				pending._emission = pending._lod == priv::ShadowLod::Soft && needsEmission(lightShapes);
+				mPendingShapes.insert(mPendingShapes.end(), lightShapes.begin(), lightShapes.end());
+			}
+			mPendingLights.push_back(pending);
+
+			if (!packed)
+			{
+				flushLightAtlas();
+			}
 		}
     }
+    flushLightAtlas();
+    renderAmortizedLights(view);
+    renderEmissionBatches(view);
 
     //----- Direction lights
 
@@ -115,6 +272,13 @@ void LightSystem::render(sf::RenderTarget& target)
 
     for (const auto& light : mDirectionEmissionLights) 
 	{
+		// Cached shadows are composited from the tiles under the view
+		if (light->getShadowTileSize() > 0.0f)
+		{
+			renderShadowTiles(*light, view);
+			continue;
+		}
+
 		// Create light shape
         sf::ConvexShape directionShape = priv::shapeFromRect(extendedViewBounds);
         directionShape.setPosition(view.getCenter());
@@ -125,15 +289,23 @@ void LightSystem::render(sf::RenderTarget& target)
         mLightShapeQuadtree.query(directionShape, viewLightShapes);
 
 		// Render light
-        light->render(view, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, viewLightShapes, shadowExtension);
+        light->render(view, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, viewLightShapes, shadowExtension, mConvexSilhouetteThreshold, mRenderStats);
         mCompositionTexture.draw(sf::Sprite(mLightTempTexture.getTexture()), sf::BlendAdd);
+        mRenderStats._drawCalls++;
     }
 
     mCompositionTexture.display();
 
+	// Only the viewport of the view is composited, the other views of the target are left untouched
+	sf::IntRect targetPixels = target.getViewport(targetView);
+	sf::IntRect bufferPixels = mCompositionTexture.getViewport(view);
 	target.setView(target.getDefaultView());
-	target.draw(sf::Sprite(mCompositionTexture.getTexture()), sf::BlendMultiply);
-	target.setView(view);
+	sf::Sprite compositionSprite(mCompositionTexture.getTexture(), bufferPixels);
+	compositionSprite.setPosition(static_cast<float>(targetPixels.left), static_cast<float>(targetPixels.top));
+	compositionSprite.setScale(targetPixels.width / static_cast<float>(std::max(1, bufferPixels.width)), targetPixels.height / static_cast<float>(std::max(1, bufferPixels.height)));
+	target.draw(compositionSprite, sf::BlendMultiply);
+	mRenderStats._drawCalls++;
+	target.setView(targetView);
 }
 
 LightShape* LightSystem::createLightShape()
@@ -218,6 +390,18 @@ LightShape* LightSystem::createLightShape(const sf::Sprite& sprite)
 	return lightShape;
 }
 
+LightShape* LightSystem::createLightShape(const std::vector<sf::Vector2f>& points)
+{
+	LightShape* lightShape = createLightShape();
+	unsigned int pointCount = points.size();
+	lightShape->setPointCount(pointCount);
+	for (unsigned int i = 0; i < pointCount; i++)
+	{
+		lightShape->setPoint(i, points[i]);
+	}
+	return lightShape;
+}
+
 void LightSystem::removeShape(LightShape* shape)
 {
 	auto itr = mLightShapes.find(shape);
@@ -229,6 +413,23 @@ void LightSystem::removeShape(LightShape* shape)
 	}
 }
 
+TileMap* LightSystem::createTileMap(const std::vector<bool>& tiles, const sf::Vector2u& size, const sf::Vector2f& tileSize, const sf::Vector2f& position, unsigned int chunkSize)
+{
+	TileMap* tileMap = new TileMap(*this, tiles, size, tileSize, position, chunkSize);
+	mTileMaps.insert(tileMap);
+	return tileMap;
+}
+
+void LightSystem::removeTileMap(TileMap* tileMap)
+{
+	auto itr = mTileMaps.find(tileMap);
+	if (itr != mTileMaps.end())
+	{
+		mTileMaps.erase(itr);
+		delete tileMap;
+	}
+}
+
 LightPointEmission* LightSystem::createLightPointEmission()
 {
 	LightPointEmission* light = new LightPointEmission();
@@ -244,6 +445,7 @@ void LightSystem::removeLight(LightPointEmission* light)
 	{
 		mLightPointEmissionQuadtree.removeOccupant(*itr);
 		mPointEmissionLights.erase(itr);
+		mLightShapesQueries.erase(light);
 		delete light;
 	}
 }
@@ -267,7 +469,11 @@ void LightSystem::removeLight(LightDirectionEmission* light)
 
 void LightSystem::addSprite(Sprite& sprite)
 {
-	mNormalSprites.insert(&sprite);
+	if (mNormalSprites.insert(&sprite).second)
+	{
+		sprite.updateAABB();
+		mNormalSpriteQuadtree.addOccupant(&sprite);
+	}
 }
 
 void LightSystem::removeSprite(Sprite& sprite)
@@ -275,7 +481,17 @@ void LightSystem::removeSprite(Sprite& sprite)
 	auto itr = mNormalSprites.find(&sprite);
 	if (itr != mNormalSprites.end())
 	{
+		mNormalSpriteQuadtree.removeOccupant(&sprite);
 		mNormalSprites.erase(itr);
+
+		// Its normals are erased on the next pass
+		auto drawn = mDrawnNormals.find(&sprite);
+		if (drawn != mDrawnNormals.end())
+		{
+			mNormalsDirty = mNormalsDirtyEmpty ? drawn->second._bounds : priv::rectUnion(mNormalsDirty, drawn->second._bounds);
+			mNormalsDirtyEmpty = false;
+			mDrawnNormals.erase(drawn);
+		}
 	}
 }
 
@@ -314,24 +530,656 @@ bool LightSystem::useNormals() const
 	return mUseNormals;
 }
 
+void LightSystem::setConvexSilhouetteThreshold(unsigned int threshold)
+{
+	mConvexSilhouetteThreshold = threshold;
+}
+
+unsigned int LightSystem::getConvexSilhouetteThreshold() const
+{
+	return mConvexSilhouetteThreshold;
+}
+
+void LightSystem::setLightBufferDownscale(unsigned int downscale)
+{
+	mLightBufferDownscale = (downscale >= 4) ? 4 : ((downscale >= 2) ? 2 : 1);
+}
+
+unsigned int LightSystem::getLightBufferDownscale() const
+{
+	return mLightBufferDownscale;
+}
+
+void LightSystem::setLightUpdateBudget(unsigned int budget)
+{
+	mLightUpdateBudget = budget;
+}
+
+unsigned int LightSystem::getLightUpdateBudget() const
+{
+	return mLightUpdateBudget;
+}
+
+void LightSystem::setHardShadowSize(float size)
+{
+	mHardShadowSize = size;
+}
+
+float LightSystem::getHardShadowSize() const
+{
+	return mHardShadowSize;
+}
+
+void LightSystem::setNoShadowSize(float size)
+{
+	mNoShadowSize = size;
+}
+
+float LightSystem::getNoShadowSize() const
+{
+	return mNoShadowSize;
+}
+
+void LightSystem::setLightTileSize(unsigned int size)
+{
+	mLightTileSize = size;
+}
+
+unsigned int LightSystem::getLightTileSize() const
+{
+	return mLightTileSize;
+}
+
+const RenderStats& LightSystem::getRenderStats() const
+{
+	return mRenderStats;
+}
+
 void LightSystem::update(sf::Vector2u const& size)
 {
 	mUnshadowShader.setUniform("penumbraTexture", mPenumbraTexture);
 	mLightOverShapeShader.setUniform("emissionTexture", mEmissionTempTexture.getTexture());
 	mNormalsShader.setUniform("normalsTexture", mNormalsTexture.getTexture());
 	mNormalsShader.setUniform("lightTexture", sf::Shader::CurrentTexture);
+	mNormalsShader.setUniform("normalsOffset", sf::Glsl::Vec2(0.0f, 0.0f));
 
 	if (size.x != 0 && size.y != 0)
 	{
-		mLightTempTexture.create(size.x, size.y);
-		mEmissionTempTexture.create(size.x, size.y);
-		mAntumbraTempTexture.create(size.x, size.y);
-		mCompositionTexture.create(size.x, size.y);
-		mNormalsTexture.create(size.x, size.y);
+		// The render textures are live together during a light, so they can't share memory, but they only grow
+		// Resizing the window or alternating between targets only changes the used part
+		mBufferSize = size;
+		priv::growRenderTexture(mLightTempTexture, size);
+		priv::growRenderTexture(mEmissionTempTexture, size);
+		priv::growRenderTexture(mAntumbraTempTexture, size);
+		priv::growRenderTexture(mCompositionTexture, size);
+		if (mUseNormals)
+		{
+			priv::growRenderTexture(mNormalsTexture, size);
+		}
+		mNormalsValid = false;
+
+		// Bilinear upsampling of the composition when the light buffer is downscaled
+		mCompositionTexture.setSmooth(mLightBufferDownscale > 1);
+
+		// The shaders work on gl_FragCoord, relative to the whole textures
+		sf::Vector2u textureSize = mLightTempTexture.getSize();
+		mNormalsShader.setUniform("targetSize", sf::Glsl::Vec2(textureSize.x * 1.f, textureSize.y * 1.f));
+		mLightOverShapeShader.setUniform("targetSizeInv", sf::Glsl::Vec2(1.0f / textureSize.x, 1.0f / textureSize.y));
+	}
+}
+
+void LightSystem::renderEmissionBatches(const sf::View& view)
+{
+	for (auto& batch : mEmissionBatches)
+	{
+		if (batch.second.getVertexCount() > 0)
+		{
+			bool tiled = mLightTileSize > 0 && batch.first != nullptr && renderTiledEmissions(*batch.first, batch.second, view);
+			if (!tiled)
+			{
+				mCompositionTexture.setView(view);
+				mCompositionTexture.draw(batch.second, sf::RenderStates(sf::BlendAdd, sf::Transform::Identity, batch.first, nullptr));
+				mCompositionTexture.setView(mCompositionTexture.getDefaultView());
+			}
+			batch.second.clear();
+			mRenderStats._drawCalls++;
+		}
+	}
+}
+
+bool LightSystem::renderTiledEmissions(const sf::Texture& texture, const sf::VertexArray& vertices, const sf::View& view)
+{
+	// Data layout : 6 texels by light, then one texel by tile (offset and count of its list), then the lists, 2 indices by texel
+	// Values are 16 bits, signed ones are stored with a quarter pixel precision
+	const unsigned int dataWidth = 1024;
+	sf::Vector2u size = mCompositionTexture.getSize();
+	sf::Vector2u tileCount((size.x + mLightTileSize - 1) / mLightTileSize, (size.y + mLightTileSize - 1) / mLightTileSize);
+	std::size_t lightCount = vertices.getVertexCount() / 6;
+	if (lightCount > 65535)
+	{
+		return false;
+	}
+
+	// Tiles touched by each light, counted then listed
+	sf::Transform pixels = priv::pixelsFromCoords(mCompositionTexture, view);
+	std::vector<sf::IntRect> lightTiles(lightCount);
+	std::vector<unsigned int> tileOffsets(tileCount.x * tileCount.y + 1, 0);
+	for (std::size_t i = 0; i < lightCount; i++)
+	{
+		// The triangles of a quad are 0 1 2 and 0 2 3
+		sf::Vector2f corners[4] = { pixels.transformPoint(vertices[i * 6].position), pixels.transformPoint(vertices[i * 6 + 1].position), pixels.transformPoint(vertices[i * 6 + 2].position), pixels.transformPoint(vertices[i * 6 + 5].position) };
+		sf::Vector2f low = corners[0];
+		sf::Vector2f high = corners[0];
+		for (int j = 1; j < 4; j++)
+		{
+			low = sf::Vector2f(std::min(low.x, corners[j].x), std::min(low.y, corners[j].y));
+			high = sf::Vector2f(std::max(high.x, corners[j].x), std::max(high.y, corners[j].y));
+		}
+		int left = std::max(0, static_cast<int>(std::floor(low.x / mLightTileSize)));
+		int top = std::max(0, static_cast<int>(std::floor(low.y / mLightTileSize)));
+		int right = std::min(static_cast<int>(tileCount.x) - 1, static_cast<int>(std::floor(high.x / mLightTileSize)));
+		int bottom = std::min(static_cast<int>(tileCount.y) - 1, static_cast<int>(std::floor(high.y / mLightTileSize)));
+		lightTiles[i] = sf::IntRect(left, top, right - left + 1, bottom - top + 1);
+		for (int y = top; y <= bottom; y++)
+		{
+			for (int x = left; x <= right; x++)
+			{
+				tileOffsets[x + y * tileCount.x + 1]++;
+			}
+		}
+	}
+	for (std::size_t i = 1; i < tileOffsets.size(); i++)
+	{
+		tileOffsets[i] += tileOffsets[i - 1];
+	}
+	unsigned int entryCount = tileOffsets.back();
+	if (entryCount == 0)
+	{
+		return true;
+	}
+	if (entryCount > 65535)
+	{
+		return false;
+	}
+
+	std::size_t tableStart = lightCount * 6;
+	std::size_t indexStart = tableStart + tileCount.x * tileCount.y;
+	std::size_t texelCount = indexStart + (entryCount + 1) / 2;
+	unsigned int dataHeight = static_cast<unsigned int>((texelCount + dataWidth - 1) / dataWidth);
+	if (dataHeight > sf::Texture::getMaximumSize())
+	{
+		return false;
+	}
+	mLightTileData.assign(dataWidth * dataHeight * 4, 0);
+
+	auto putValues = [&](std::size_t texel, unsigned int x, unsigned int y)
+	{
+		sf::Uint8* data = &mLightTileData[texel * 4];
+		data[0] = static_cast<sf::Uint8>(x >> 8);
+		data[1] = static_cast<sf::Uint8>(x & 255);
+		data[2] = static_cast<sf::Uint8>(y >> 8);
+		data[3] = static_cast<sf::Uint8>(y & 255);
+	};
+	auto putSigned = [&](std::size_t texel, const sf::Vector2f& value)
+	{
+		float x = std::floor(value.x * 4.0f + 32768.5f);
+		float y = std::floor(value.y * 4.0f + 32768.5f);
+		if (x < 0.0f || x > 65535.0f || y < 0.0f || y > 65535.0f)
+		{
+			return false;
+		}
+		putValues(texel, static_cast<unsigned int>(x), static_cast<unsigned int>(y));
+		return true;
+	};
+
+	// Lights : origin, both sides, texture coordinates of the origin, texture sides, color
+	for (std::size_t i = 0; i < lightCount; i++)
+	{
+		const sf::Vertex& origin = vertices[i * 6];
+		const sf::Vertex& sideU = vertices[i * 6 + 1];
+		const sf::Vertex& sideV = vertices[i * 6 + 5];
+		sf::Vector2f pixelOrigin = pixels.transformPoint(origin.position);
+		bool fits = putSigned(i * 6, pixelOrigin)
+			&& putSigned(i * 6 + 1, pixels.transformPoint(sideU.position) - pixelOrigin)
+			&& putSigned(i * 6 + 2, pixels.transformPoint(sideV.position) - pixelOrigin)
+			&& putSigned(i * 6 + 3, origin.texCoords)
+			&& putSigned(i * 6 + 4, sf::Vector2f(sideU.texCoords.x - origin.texCoords.x, sideV.texCoords.y - origin.texCoords.y));
+		if (!fits)
+		{
+			return false;
+		}
+		sf::Uint8* color = &mLightTileData[(i * 6 + 5) * 4];
+		color[0] = origin.color.r;
+		color[1] = origin.color.g;
+		color[2] = origin.color.b;
+		color[3] = origin.color.a;
+	}
+
+	// Tiles and their lists, with the quads of the touched tiles
+	mLightTileVertices.clear();
+	std::vector<unsigned int> tileFill(tileOffsets.begin(), tileOffsets.end() - 1);
+	for (std::size_t i = 0; i < lightCount; i++)
+	{
+		const sf::IntRect& tiles = lightTiles[i];
+		for (int y = tiles.top; y < tiles.top + tiles.height; y++)
+		{
+			for (int x = tiles.left; x < tiles.left + tiles.width; x++)
+			{
+				unsigned int entry = tileFill[x + y * tileCount.x]++;
+				mLightTileData[(indexStart + entry / 2) * 4 + (entry % 2) * 2] = static_cast<sf::Uint8>(i >> 8);
+				mLightTileData[(indexStart + entry / 2) * 4 + (entry % 2) * 2 + 1] = static_cast<sf::Uint8>(i & 255);
+			}
+		}
+	}
+	for (unsigned int y = 0; y < tileCount.y; y++)
+	{
+		for (unsigned int x = 0; x < tileCount.x; x++)
+		{
+			unsigned int tile = x + y * tileCount.x;
+			unsigned int count = tileOffsets[tile + 1] - tileOffsets[tile];
+			putValues(tableStart + tile, tileOffsets[tile], count);
+			if (count > 0)
+			{
+				float left = static_cast<float>(x * mLightTileSize);
+				float top = static_cast<float>(y * mLightTileSize);
+				float right = static_cast<float>(std::min((x + 1) * mLightTileSize, size.x));
+				float bottom = static_cast<float>(std::min((y + 1) * mLightTileSize, size.y));
+				sf::Vertex quad[4] = { sf::Vertex({ left, top }), sf::Vertex({ right, top }), sf::Vertex({ right, bottom }), sf::Vertex({ left, bottom }) };
+				priv::appendQuad(mLightTileVertices, quad);
+			}
+		}
+	}
+
+	// The tile texture only grows
+	if (mLightTileTexture.getSize().x < dataWidth || mLightTileTexture.getSize().y < dataHeight)
+	{
+		mLightTileTexture.create(dataWidth, std::max(dataHeight, mLightTileTexture.getSize().y));
+	}
+	mLightTileTexture.update(mLightTileData.data(), dataWidth, dataHeight, 0, 0);
+
+	sf::Vector2u textureSize = texture.getSize();
+	mLightTileShader.setUniform("dataTexture", mLightTileTexture);
+	mLightTileShader.setUniform("lightTexture", texture);
+	mLightTileShader.setUniform("dataSize", sf::Glsl::Vec2(static_cast<float>(mLightTileTexture.getSize().x), static_cast<float>(mLightTileTexture.getSize().y)));
+	mLightTileShader.setUniform("lightTextureSizeInv", sf::Glsl::Vec2(1.0f / textureSize.x, 1.0f / textureSize.y));
+	mLightTileShader.setUniform("targetHeight", static_cast<float>(size.y));
+	mLightTileShader.setUniform("tileSize", static_cast<float>(mLightTileSize));
+	mLightTileShader.setUniform("tileCountX", static_cast<float>(tileCount.x));
+	mLightTileShader.setUniform("tableStart", static_cast<float>(tableStart));
+	mLightTileShader.setUniform("indexStart", static_cast<float>(indexStart));
+
+	mCompositionTexture.draw(mLightTileVertices, sf::RenderStates(sf::BlendAdd, sf::Transform::Identity, nullptr, &mLightTileShader));
+	return true;
+}
+
+void LightSystem::renderAmortizedLights(const sf::View& view)
+{
+	// The budget is spent on the lights with the highest priority, the ones which must be rendered again go beyond it
+	std::sort(mAmortizedLights.begin(), mAmortizedLights.end(), [](const std::pair<float, LightPointEmission*>& left, const std::pair<float, LightPointEmission*>& right)
+	{
+		return left.first > right.first;
+	});
+
+	for (std::size_t i = 0; i < mAmortizedLights.size(); i++)
+	{
+		// The lights rendered for a previous view of the pass are not rendered again
+		LightPointEmission& light = *mAmortizedLights[i].second;
+		bool rendered = light.getCacheRenderFrame() == mFrameCount;
+		bool forced = mAmortizedLights[i].first == std::numeric_limits<float>::max();
+		if (!rendered && (forced || mLightUpdates < mLightUpdateBudget))
+		{
+			renderLightCache(light, queryLightShapes(light));
+
+			// Only the lights rendered again without being forced count against the budget of the pass
+			if (!forced)
+			{
+				mLightUpdates++;
+			}
+		}
+		else
+		{
+			mRenderStats._cachedLights++;
+		}
+		compositeLightCache(light, view);
+	}
+	mAmortizedLights.clear();
+}
+
+void LightSystem::renderLightCache(LightPointEmission& light, const std::vector<priv::QuadtreeOccupant*>& shapes)
+{
+	sf::FloatRect bounds = light.getAABB();
+
+	// Render the whole AABB box at the scale of the light buffer, smaller if it does not fit in the light render texture
+	sf::Vector2u size = mLightTempTexture.getSize();
+	float scale = std::min(1.0f / mLightBufferDownscale, std::min(size.x / bounds.width, size.y / bounds.height));
+	sf::IntRect slot(0, 0, std::max(1, static_cast<int>(std::ceil(bounds.width * scale))), std::max(1, static_cast<int>(std::ceil(bounds.height * scale))));
+	sf::View cacheView(bounds);
+	cacheView.setViewport(sf::FloatRect(0.0f, 0.0f, slot.width / static_cast<float>(size.x), slot.height / static_cast<float>(size.y)));
+
+	// The slot overlaps the atlas
+	flushLightAtlas();
+
+	// The emission is only sampled by the shapes rendering the light over them
+	if (needsEmission(shapes))
+	{
+		priv::clearPixels(mEmissionTempTexture, slot, sf::Color::Black);
+		mEmissionTempTexture.setView(cacheView);
+		mEmissionTempTexture.draw(light);
+		mEmissionTempTexture.display();
+		mRenderStats._drawCalls += 2;
+	}
+
+	light.render(cacheView, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, mLightOverShapeShader, shapes, false, mNormalsShader, mConvexSilhouetteThreshold, mFrameCount, priv::ShadowLod::Soft, mRenderStats);
+
+	sf::RenderTexture& cache = light.getCacheTexture(sf::Vector2u(slot.width, slot.height));
+	cache.draw(sf::Sprite(mLightTempTexture.getTexture(), slot), sf::BlendNone);
+	cache.display();
+	mRenderStats._drawCalls++;
+	light.validateCache(shapes, mFrameCount);
+}
+
+void LightSystem::compositeLightCache(LightPointEmission& light, const sf::View& view)
+{
+	sf::FloatRect bounds = light.getAABB();
+	const sf::RenderTexture& cache = *light.getCacheTexture();
+	sf::Sprite sprite(cache.getTexture());
+	sprite.setPosition(bounds.left, bounds.top);
+	sprite.setScale(bounds.width / cache.getSize().x, bounds.height / cache.getSize().y);
+	mCompositionTexture.setView(view);
+	mCompositionTexture.draw(sprite, sf::BlendAdd);
+	mCompositionTexture.setView(mCompositionTexture.getDefaultView());
+	mRenderStats._drawCalls++;
+}
+
+void LightSystem::renderShadowTiles(LightDirectionEmission& light, const sf::View& view)
+{
+	// Tiles are rendered at the scale of the light buffer, in the top left corner of the light render texture
+	float tileSize = light.getShadowTileSize();
+	sf::Vector2u size = mLightTempTexture.getSize();
+	unsigned int pixels = std::min(std::min(size.x, size.y), std::max(1u, static_cast<unsigned int>(std::ceil(tileSize / mLightBufferDownscale))));
+
+	sf::FloatRect visibleBounds = view.getInverseTransform().transformRect(sf::FloatRect(-1.0f, -1.0f, 2.0f, 2.0f));
+	int left = static_cast<int>(std::floor(visibleBounds.left / tileSize));
+	int top = static_cast<int>(std::floor(visibleBounds.top / tileSize));
+	int right = static_cast<int>(std::floor((visibleBounds.left + visibleBounds.width) / tileSize));
+	int bottom = static_cast<int>(std::floor((visibleBounds.top + visibleBounds.height) / tileSize));
+
+	// Shapes up to the emission range against the cast direction can shadow a tile
+	sf::Vector2f upstream = -light.getCastDirection() * mDirectionEmissionRange;
+
+	// Shapes beside them too, their penumbras spread sideways over the range
+	float spread = (light.getSourceDistance() > 0.0f) ? mDirectionEmissionRange * light.getSourceRadius() / light.getSourceDistance() : 0.0f;
+	sf::Vector2f margin(std::abs(light.getCastDirection().y) * spread, std::abs(light.getCastDirection().x) * spread);
+
+	std::vector<priv::QuadtreeOccupant*> tileShapes;
+	mCompositionTexture.setView(view);
+	for (int y = top; y <= bottom; y++)
+	{
+		for (int x = left; x <= right; x++)
+		{
+			sf::Vector2i tile(x, y);
+			sf::FloatRect tileRect(x * tileSize, y * tileSize, tileSize, tileSize);
+			tileShapes.clear();
+			sf::FloatRect queryRect = priv::rectUnion(tileRect, sf::FloatRect(tileRect.left + upstream.x, tileRect.top + upstream.y, tileSize, tileSize));
+			mLightShapeQuadtree.query(sf::FloatRect(queryRect.left - margin.x, queryRect.top - margin.y, queryRect.width + margin.x * 2.0f, queryRect.height + margin.y * 2.0f), tileShapes);
+
+			if (light.updateShadowTile(tile, tileShapes, pixels))
+			{
+				sf::View tileView(tileRect);
+				tileView.setViewport(sf::FloatRect(0.0f, 0.0f, pixels / static_cast<float>(size.x), pixels / static_cast<float>(size.y)));
+				light.render(tileView, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, tileShapes, tileSize, mConvexSilhouetteThreshold, mRenderStats);
+
+				sf::RenderTexture& texture = light.getShadowTileTexture(tile);
+				texture.draw(sf::Sprite(mLightTempTexture.getTexture(), sf::IntRect(0, 0, pixels, pixels)), sf::BlendNone);
+				texture.display();
+				mRenderStats._drawCalls++;
+			}
+			else
+			{
+				mRenderStats._cachedShadowTiles++;
+			}
+
+			sf::Sprite sprite(light.getShadowTileTexture(tile).getTexture());
+			sprite.setPosition(tileRect.left, tileRect.top);
+			sprite.setScale(tileSize / pixels, tileSize / pixels);
+			mCompositionTexture.draw(sprite, sf::BlendAdd);
+			mRenderStats._drawCalls++;
+		}
+	}
+	mCompositionTexture.setView(mCompositionTexture.getDefaultView());
+
+	light.releaseShadowTiles();
+}
+
+void LightSystem::flushLightAtlas()
+{
+	if (!mPendingLights.empty())
+	{
+		renderPendingEmissions();
+
+		std::vector<priv::QuadtreeOccupant*> shapes;
+		for (const auto& pending : mPendingLights)
+		{
+			const sf::IntRect& footprint = pending._footprint;
+			const sf::IntRect& slot = pending._slot;
+
+			// The normals are rendered on the screen, offset the lookup from the slot (OpenGL coordinates)
+			mNormalsShader.setUniform("normalsOffset", sf::Glsl::Vec2(static_cast<float>(footprint.left - slot.left), static_cast<float>(slot.top - footprint.top)));
+
+			shapes.assign(mPendingShapes.begin() + pending._firstShape, mPendingShapes.begin() + pending._firstShape + pending._shapeCount);
+			pending._light->render(pending._view, mLightTempTexture, mAntumbraTempTexture, mUnshadowShader, mLightOverShapeShader, shapes, mUseNormals, mNormalsShader, mConvexSilhouetteThreshold, mFrameCount, pending._lod, mRenderStats);
+
+			sf::Vector2f corners[4] = { { 0.f, 0.f }, { footprint.width * 1.f, 0.f }, { footprint.width * 1.f, footprint.height * 1.f }, { 0.f, footprint.height * 1.f } };
+			sf::Vertex quad[4];
+			for (int i = 0; i < 4; i++)
+			{
+				quad[i] = sf::Vertex(corners[i] + sf::Vector2f(footprint.left * 1.f, footprint.top * 1.f), corners[i] + sf::Vector2f(slot.left * 1.f, slot.top * 1.f));
+			}
+			priv::appendQuad(mLightAtlasVertices, quad);
+		}
+		mPendingLights.clear();
+		mPendingShapes.clear();
+
+		mCompositionTexture.draw(mLightAtlasVertices, sf::RenderStates(sf::BlendAdd, sf::Transform::Identity, &mLightTempTexture.getTexture(), nullptr));
+		mLightAtlasVertices.clear();
+		mRenderStats._drawCalls++;
+	}
+	mLightAtlas.reset(mLightTempTexture.getSize());
+}
+
+void LightSystem::renderPendingEmissions()
+{
+	// Clear the slots of the lights whose emission is sampled by the light over shape shader
+	sf::VertexArray clearVertices(sf::Triangles);
+	for (const auto& pending : mPendingLights)
+	{
+		if (pending._emission)
+		{
+			sf::FloatRect slot(pending._slot);
+			sf::Vertex quad[4] = { sf::Vertex({ slot.left, slot.top }, sf::Color::Black), sf::Vertex({ slot.left + slot.width, slot.top }, sf::Color::Black), sf::Vertex({ slot.left + slot.width, slot.top + slot.height }, sf::Color::Black), sf::Vertex({ slot.left, slot.top + slot.height }, sf::Color::Black) };
+			priv::appendQuad(clearVertices, quad);
+		}
+	}
+	if (clearVertices.getVertexCount() == 0)
+	{
+		return;
+	}
+	mEmissionTempTexture.setView(mEmissionTempTexture.getDefaultView());
+	mEmissionTempTexture.draw(clearVertices, sf::BlendNone);
+	mRenderStats._drawCalls++;
+
+	// Draw the sprites of the lights in their slots, one draw per texture
+	sf::VertexArray emissionVertices(sf::Triangles);
+	const sf::Texture* texture = nullptr;
+	for (const auto& pending : mPendingLights)
+	{
+		if (!pending._emission)
+		{
+			continue;
+		}
+		const LightPointEmission& light = *pending._light;
+		if (light.getTexture() != texture && emissionVertices.getVertexCount() > 0)
+		{
+			mEmissionTempTexture.draw(emissionVertices, texture);
+			emissionVertices.clear();
+			mRenderStats._drawCalls++;
+		}
+		texture = light.getTexture();
+
+		sf::Vertex quad[4];
+		priv::spriteQuad(quad, priv::pixelsFromCoords(mEmissionTempTexture, pending._view) * light.getTransform(), light.getTextureRect(), light.getColor());
+		priv::appendClippedQuad(emissionVertices, quad, sf::FloatRect(pending._slot));
+	}
+	if (emissionVertices.getVertexCount() > 0)
+	{
+		mEmissionTempTexture.draw(emissionVertices, texture);
+		mRenderStats._drawCalls++;
+	}
+	mEmissionTempTexture.display();
+}
+
+void LightSystem::renderNormals(const sf::View& view, const sf::FloatRect& viewBounds)
+{
+	// The whole buffer is redrawn when the view changed, otherwise only around the sprites which changed
+	bool full = !mNormalsValid || view.getCenter() != mNormalsView.getCenter() || view.getSize() != mNormalsView.getSize() || view.getRotation() != mNormalsView.getRotation() || view.getViewport() != mNormalsView.getViewport();
+	mNormalsValid = true;
+	mNormalsView = view;
+	mNormalsFrame++;
+
+	auto addDirty = [this](const sf::FloatRect& rect)
+	{
+		mNormalsDirty = mNormalsDirtyEmpty ? rect : priv::rectUnion(mNormalsDirty, rect);
+		mNormalsDirtyEmpty = false;
+	};
 
-		mNormalsShader.setUniform("targetSize", sf::Glsl::Vec2(size.x * 1.f, size.y * 1.f));
-		mLightOverShapeShader.setUniform("targetSizeInv", sf::Glsl::Vec2(1.0f / size.x, 1.0f / size.y));
+	// Sprites of the pass under this view, the ones which are new or changed are dirty
+	std::vector<Sprite*> sprites;
+	for (Sprite* sprite : mRenderedNormals)
+	{
+		if (sprite->getAABB().intersects(viewBounds))
+		{
+			sprites.push_back(sprite);
+			DrawnNormals& drawn = mDrawnNormals[sprite];
+			if (drawn._version != sprite->getNormalsVersion())
+			{
+				if (drawn._version != 0)
+				{
+					addDirty(drawn._bounds);
+				}
+				addDirty(sprite->getAABB());
+				drawn._bounds = sprite->getAABB();
+				drawn._version = sprite->getNormalsVersion();
+			}
+			drawn._frame = mNormalsFrame;
+		}
+	}
+
+	// Sprites drawn in the buffer which are not anymore
+	for (auto itr = mDrawnNormals.begin(); itr != mDrawnNormals.end();)
+	{
+		if (itr->second._frame != mNormalsFrame)
+		{
+			addDirty(itr->second._bounds);
+			itr = mDrawnNormals.erase(itr);
+		}
+		else
+		{
+			itr++;
+		}
+	}
+
+	sf::FloatRect area = viewBounds;
+	if (full)
+	{
+		mNormalsTexture.clear(sf::Color(127u, 127u, 255u));
+		mNormalsTexture.setView(view);
+	}
+	else if (!mNormalsDirtyEmpty)
+	{
+		// The viewport of the view clips the sprites to the dirty pixels
+		sf::IntRect pixels = priv::rectToPixels(mNormalsTexture, view, mNormalsDirty);
+		if (pixels.width <= 0 || pixels.height <= 0)
+		{
+			mNormalsDirtyEmpty = true;
+			return;
+		}
+		priv::clearPixels(mNormalsTexture, pixels, sf::Color(127u, 127u, 255u));
+		mNormalsTexture.setView(priv::viewFromPixels(mNormalsTexture, view, pixels, pixels));
+		mRenderStats._drawCalls++;
+
+		// The cleared pixels are rounded outward and, with a rotated view, cover more than the dirty area
+		area = priv::pixelsFromCoords(mNormalsTexture, view).getInverse().transformRect(sf::FloatRect(pixels));
+	}
+	else
+	{
+		return;
+	}
+	mNormalsDirtyEmpty = true;
+
+	// Batched by normals texture
+	for (Sprite* sprite : sprites)
+	{
+		if (full || sprite->getAABB().intersects(area))
+		{
+			sf::VertexArray& batch = mNormalsBatches[sprite->getNormalsTexture()];
+			batch.setPrimitiveType(sf::Triangles);
+			sprite->appendNormals(batch);
+		}
+	}
+	for (auto& batch : mNormalsBatches)
+	{
+		if (batch.second.getVertexCount() > 0)
+		{
+			mNormalsTexture.draw(batch.second, batch.first);
+			batch.second.clear();
+			mRenderStats._drawCalls++;
+		}
+	}
+	mNormalsTexture.display();
+}
+
+const std::vector<priv::QuadtreeOccupant*>& LightSystem::queryLightShapes(LightPointEmission& light)
+{
+	LightShapesQuery& query = mLightShapesQueries[&light];
+	if (query._pass != mFrameCount)
+	{
+		query._pass = mFrameCount;
+		query._shapes.clear();
+		if (light.castsShadows())
+		{
+			mLightShapeQuadtree.query(light.getAABB(), query._shapes);
+		}
+	}
+	return query._shapes;
+}
+
+priv::ShadowLod LightSystem::getShadowLod(const LightPointEmission& light, const sf::View& view) const
+{
+	// The whole light after the view transform, not clipped to the screen, so the level doesn't change while panning
+	// The pixels of the light render texture are converted to pixels of the target, in which the thresholds are
+	sf::FloatRect bounds = priv::pixelsFromCoords(mLightTempTexture, view).transformRect(light.getAABB());
+	float size = std::max(bounds.width, bounds.height) * mLightBufferDownscale;
+	if (size < mNoShadowSize)
+	{
+		return priv::ShadowLod::None;
+	}
+	if (size < mHardShadowSize)
+	{
+		return priv::ShadowLod::Hard;
+	}
+	return priv::ShadowLod::Soft;
+}
+
+bool LightSystem::needsEmission(const std::vector<priv::QuadtreeOccupant*>& shapes) const
+{
+	for (const auto& occupant : shapes)
+	{
+		if (static_cast<LightShape*>(occupant)->renderLightOver())
+		{
+			return true;
+		}
 	}
+	return false;
 }
 
 sf::Texture& LightSystem::getPenumbraTexture()
@@ -1,14 +1,23 @@
+#include <algorithm>
+
 #include "Sprite.hpp"
 
 namespace ltbl
 {
 
 Sprite::Sprite()
-	: BaseLight()
+	: QuadtreeOccupant()
+	, BaseLight()
 	, sf::Sprite()
 	, mTexture(nullptr)
 	, mNormalsTexture(nullptr)
 	, mNeedRenderNormals(false)
+	, mAABB()
+	, mNormalsVersion(priv::nextVersionStamp())
+	, mNormalsTransform()
+	, mNormalsRect()
+	, mNormalsColor()
+	, mNormalsTextureUsed(nullptr)
 {
 }
 
@@ -32,6 +41,18 @@ void Sprite::render(sf::RenderTarget& target, sf::RenderStates states)
 {
 	target.draw(*this, states);
 	mNeedRenderNormals = true;
+	updateAABB();
+
+	// The normals buffer only redraws the sprites whose version changed
+	const float* matrix = getTransform().getMatrix();
+	if (!std::equal(matrix, matrix + 16, mNormalsTransform.getMatrix()) || getTextureRect() != mNormalsRect || getColor() != mNormalsColor || mNormalsTexture != mNormalsTextureUsed)
+	{
+		mNormalsTransform = getTransform();
+		mNormalsRect = getTextureRect();
+		mNormalsColor = getColor();
+		mNormalsTextureUsed = mNormalsTexture;
+		mNormalsVersion = priv::nextVersionStamp();
+	}
 }
 
 void Sprite::renderNormals(sf::RenderTarget& target, sf::RenderStates states)
@@ -45,4 +66,36 @@ void Sprite::renderNormals(sf::RenderTarget& target, sf::RenderStates states)
 	mNeedRenderNormals = false;
 }
 
+void Sprite::appendNormals(sf::VertexArray& vertices) const
+{
+	priv::appendQuad(vertices, getTransform(), getTextureRect(), getColor());
+}
+
+bool Sprite::consumeRenderNormals()
+{
+	bool needRenderNormals = mNeedRenderNormals;
+	mNeedRenderNormals = false;
+	return needRenderNormals;
+}
+
+std::size_t Sprite::getNormalsVersion() const
+{
+	return mNormalsVersion;
+}
+
+void Sprite::updateAABB()
+{
+	sf::FloatRect bounds = getGlobalBounds();
+	if (bounds != mAABB)
+	{
+		mAABB = bounds;
+		quadtreeAABBChanged();
+	}
+}
+
+sf::FloatRect Sprite::getAABB() const
+{
+	return mAABB;
+}
+
 } // namespace ltbl
\ No newline at end of file
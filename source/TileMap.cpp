@@ -0,0 +1,148 @@
+#include <algorithm>
+
+#include "TileMap.hpp"
+#include "LightSystem.hpp"
+
+namespace ltbl
+{
+
+TileMap::TileMap(LightSystem& system, const std::vector<bool>& tiles, const sf::Vector2u& size, const sf::Vector2f& tileSize, const sf::Vector2f& position, unsigned int chunkSize)
+	: mSystem(system)
+	, mTiles(tiles)
+	, mSize(size)
+	, mTileSize(tileSize)
+	, mPosition(position)
+	, mChunkSize(std::max(chunkSize, 1u))
+	, mChunkCount()
+	, mChunkShapes()
+	, mDirtyChunks()
+	, mDirty(true)
+{
+	mTiles.resize(mSize.x * mSize.y, false);
+	mChunkCount.x = (mSize.x + mChunkSize - 1) / mChunkSize;
+	mChunkCount.y = (mSize.y + mChunkSize - 1) / mChunkSize;
+	mChunkShapes.resize(mChunkCount.x * mChunkCount.y);
+	mDirtyChunks.resize(mChunkCount.x * mChunkCount.y, true);
+}
+
+TileMap::~TileMap()
+{
+	for (auto& shapes : mChunkShapes)
+	{
+		for (LightShape* shape : shapes)
+		{
+			mSystem.removeShape(shape);
+		}
+	}
+}
+
+void TileMap::setTile(unsigned int x, unsigned int y, bool solid)
+{
+	if (x < mSize.x && y < mSize.y && mTiles[x + y * mSize.x] != solid)
+	{
+		mTiles[x + y * mSize.x] = solid;
+		mDirtyChunks[x / mChunkSize + (y / mChunkSize) * mChunkCount.x] = true;
+		mDirty = true;
+	}
+}
+
+bool TileMap::getTile(unsigned int x, unsigned int y) const
+{
+	return x < mSize.x && y < mSize.y && mTiles[x + y * mSize.x];
+}
+
+const sf::Vector2u& TileMap::getSize() const
+{
+	return mSize;
+}
+
+unsigned int TileMap::getShapeCount() const
+{
+	unsigned int count = 0;
+	for (const auto& shapes : mChunkShapes)
+	{
+		count += shapes.size();
+	}
+	return count;
+}
+
+void TileMap::update()
+{
+	if (mDirty)
+	{
+		for (unsigned int i = 0; i < mDirtyChunks.size(); i++)
+		{
+			if (mDirtyChunks[i])
+			{
+				mergeChunk(i);
+				mDirtyChunks[i] = false;
+			}
+		}
+		mDirty = false;
+	}
+}
+
+void TileMap::mergeChunk(unsigned int chunk)
+{
+	std::vector<LightShape*>& shapes = mChunkShapes[chunk];
+	for (LightShape* shape : shapes)
+	{
+		mSystem.removeShape(shape);
+	}
+	shapes.clear();
+
+	unsigned int left = (chunk % mChunkCount.x) * mChunkSize;
+	unsigned int top = (chunk / mChunkCount.x) * mChunkSize;
+	unsigned int right = std::min(left + mChunkSize, mSize.x);
+	unsigned int bottom = std::min(top + mChunkSize, mSize.y);
+
+	// Greedy merge : grow each free solid tile to the right, then down while the whole row is free and solid
+	std::vector<bool> used((right - left) * (bottom - top), false);
+	auto isFree = [&](unsigned int x, unsigned int y)
+	{
+		return mTiles[x + y * mSize.x] && !used[(x - left) + (y - top) * (right - left)];
+	};
+
+	for (unsigned int y = top; y < bottom; y++)
+	{
+		for (unsigned int x = left; x < right; x++)
+		{
+			if (!isFree(x, y))
+			{
+				continue;
+			}
+
+			unsigned int width = 1;
+			while (x + width < right && isFree(x + width, y))
+			{
+				width++;
+			}
+
+			unsigned int height = 1;
+			bool rowFree = true;
+			while (y + height < bottom && rowFree)
+			{
+				for (unsigned int i = 0; i < width && rowFree; i++)
+				{
+					rowFree = isFree(x + i, y + height);
+				}
+				if (rowFree)
+				{
+					height++;
+				}
+			}
+
+			for (unsigned int j = 0; j < height; j++)
+			{
+				for (unsigned int i = 0; i < width; i++)
+				{
+					used[(x + i - left) + (y + j - top) * (right - left)] = true;
+				}
+			}
+
+			shapes.push_back(mSystem.createLightShape(sf::FloatRect(mPosition.x + x * mTileSize.x, mPosition.y + y * mTileSize.y, width * mTileSize.x, height * mTileSize.y)));
+		}
+	}
+}
+
+} // namespace ltbl